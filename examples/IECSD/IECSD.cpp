@@ -37,11 +37,22 @@
 #define FT_PRG       0x01
 #define FT_SEQ       0x02
 #define FT_DIR       0x04
+#define FT_REL       0x08
 #define FT_ANY       0xFF
 #define FT_NODIR     ((FT_ANY) & ~(FT_DIR))
 
 #define SHOW_LOWERCASE 0
 
+#define DC_INVALID   0 // directory cache is empty
+#define DC_FILLING   1 // directory is being listed and entries are added to the cache
+#define DC_VALID     2 // cache holds the complete listing of the current directory
+#define DC_READING   3 // directory listing is being served from the cache
+#define DC_STALE     4 // as DC_READING but cache gets discarded when the listing is done
+
+#define NI_INVALID   0 // name index must be (re-)built before it can be used
+#define NI_VALID     1 // name index holds all entries of the current directory
+#define NI_TOOLARGE  2 // directory does not fit into the index, search it linearly
+
 #if !defined(SD_FAT_VERSION) || SD_FAT_VERSION<20200
 #error This code requires SdFat library version 2.2.0 or later
 #endif
@@ -65,9 +76,26 @@ IECSD::IECSD(uint8_t devnum, uint8_t pinChipSelect, uint8_t pinLED) :
   IECFileDevice(devnum)
 {
   m_cardOk = false;
+  memset(m_fileChannel, 0xFF, IECSD_MAX_FILES);
   m_pinLED = pinLED;
   m_pinChipSelect = pinChipSelect;
   m_dirFormat = 1;
+#if IECSD_DIRCACHE_SIZE>0
+  m_dirCacheState = DC_INVALID;
+#endif
+#if IECSD_NAMEINDEX_SIZE>0
+  m_nameIndexState = NI_INVALID;
+#endif
+#if IECSD_READBUFFER_SIZE>0
+  m_readBufferChannel = 0xFF;
+  m_readBufferLen = m_readBufferPtr = 0;
+#endif
+#if IECSD_WRITEBUFFER_SIZE>0
+  m_writeBufferChannel = 0xFF;
+#endif
+#ifdef IECSD_EPYX_WRITE_BATCH
+  m_epyxNumSectors = 0;
+#endif
   m_suppressMemExeError = false;
   m_suppressReset  = false;
 #ifdef HAVE_VDRIVE
@@ -126,7 +154,8 @@ void IECSD::task()
       static unsigned long nextblink = 0;
       if( m_errorCode==E_OK || m_errorCode==E_SPLASH || m_errorCode==E_SCRATCHED )
         {
-          bool active = m_dir || m_file;
+          bool active = m_dir;
+          for(uint8_t i=0; i<IECSD_MAX_FILES; i++) active |= m_files[i].isOpen();
 #ifdef HAVE_VDRIVE
           active |= (m_drive!=NULL) && (m_drive->getNumOpenChannels()>0);
 #endif
@@ -148,6 +177,10 @@ void IECSD::task()
 
       bool found = false;
       SdFile file, dir;
+#ifdef IECSD_EPYX_WRITE_BATCH
+      // write held-back sectors before switching to a different image
+      flushEpyxSectors();
+#endif
       if( dir.openCwd() )
         {
           char buf1[256], buf2[256];
@@ -235,7 +268,16 @@ bool IECSD::epyxReadSector(uint8_t track, uint8_t sector, uint8_t *buffer)
 {
   bool res = false;
 
+#ifdef IECSD_EPYX_WRITE_BATCH
+  // if the sector was written but is still being held back then return that data
+  for(uint8_t i=0; i<m_epyxNumSectors && !res; i++)
+    if( m_epyxTrack[i]==track && m_epyxSector[i]==sector )
+      { memcpy(buffer, m_epyxSectorData[i], 256); res = true; }
+
+  if( !res && m_drive!=NULL )
+#else
   if( m_drive!=NULL )
+#endif
     res = m_drive->readSector(track, sector, buffer);
 
   // for debug log
@@ -252,11 +294,58 @@ bool IECSD::epyxWriteSector(uint8_t track, uint8_t sector, uint8_t *buffer)
   // for debug log
   IECFileDevice::epyxWriteSector(track, sector, buffer);
 
+#ifdef IECSD_EPYX_WRITE_BATCH
+  if( m_drive!=NULL )
+    {
+      // hold back the sector until epyxSectorOpsDone() is called (or the buffer is full),
+      // if the sector is already being held back then replace its data
+      uint8_t i = 0;
+      while( i<m_epyxNumSectors && !(m_epyxTrack[i]==track && m_epyxSector[i]==sector) ) i++;
+      if( i==IECSD_EPYX_WRITE_SECTORS )
+        {
+          if( !flushEpyxSectors() ) return false;
+          i = 0;
+        }
+
+      memcpy(m_epyxSectorData[i], buffer, 256);
+      m_epyxTrack[i]  = track;
+      m_epyxSector[i] = sector;
+      if( i==m_epyxNumSectors ) m_epyxNumSectors++;
+      res = true;
+    }
+#else
   if( m_drive!=NULL )
     res = m_drive->writeSector(track, sector, buffer);
+#endif
 
   return res;
 }
+
+
+void IECSD::epyxSectorOpsDone()
+{
+  // for debug log
+  IECFileDevice::epyxSectorOpsDone();
+
+#ifdef IECSD_EPYX_WRITE_BATCH
+  // write all sectors that have been held back
+  if( !flushEpyxSectors() ) m_errorCode = E_WRITE;
+#endif
+}
+
+
+#ifdef IECSD_EPYX_WRITE_BATCH
+bool IECSD::flushEpyxSectors()
+{
+  bool res = true;
+  for(uint8_t i=0; i<m_epyxNumSectors; i++)
+    if( m_drive==NULL || !m_drive->writeSector(m_epyxTrack[i], m_epyxSector[i], m_epyxSectorData[i]) )
+      res = false;
+
+  m_epyxNumSectors = 0;
+  return res;
+}
+#endif
 #endif
 
 
@@ -310,6 +399,7 @@ uint8_t IECSD::chdir(const char *c)
         {
           // dir should be a valid directory at this point
           m_sd.chdir(dir);
+          invalidateDirCache();
 
           // append the new arc to the directory
           if( dirlen>0 && dir[dirlen-1]!='/') strcat(dir, "/");
@@ -371,6 +461,8 @@ uint8_t IECSD::chdir(const char *c)
   else
     m_sd.chdir(m_cwd);
 
+  invalidateDirCache();
+
   return res;
 }
 
@@ -396,6 +488,7 @@ uint8_t IECSD::openDir(const char *pattern)
     {
       m_dirPattern = m_cwd + strlen(m_cwd) + 1;
       strcpy(m_dirPattern, pattern);
+      compilePattern(m_dirMatch, m_dirPattern, FT_ANY, true);
     }
 
   if( m_dir.openCwd() )
@@ -420,6 +513,25 @@ uint8_t IECSD::openDir(const char *pattern)
           m_bufferLen += 32;
         }
 
+#if IECSD_DIRCACHE_SIZE>0
+      // an earlier listing may have been aborted
+      if( m_dirCacheState==DC_READING ) 
+        m_dirCacheState = DC_VALID;
+      else if( m_dirCacheState==DC_FILLING || m_dirCacheState==DC_STALE )
+        m_dirCacheState = DC_INVALID;
+
+      // only complete listings (no pattern) are cached
+      if( m_dirPattern==NULL )
+        {
+          if( m_dirCacheState==DC_VALID )
+            m_dirCacheState = DC_READING;
+          else
+            { m_dirCacheState = DC_FILLING; m_dirCacheLen = 0; }
+
+          m_dirCachePtr = 0;
+        }
+#endif
+
       res = E_OK;
     }
   else
@@ -440,7 +552,20 @@ bool IECSD::readDir(uint8_t *data)
           m_bufferLen = 0;
 
           SdFile f;
+#if IECSD_DIRCACHE_SIZE>0
+          bool fromCache = m_dirCacheState==DC_READING || m_dirCacheState==DC_STALE;
+          if( fromCache && m_dirCachePtr<m_dirCacheLen )
+            {
+              // get the next entry from the directory cache
+              m_bufferLen = m_dirCache[m_dirCachePtr++];
+              memcpy(m_buffer, m_dirCache+m_dirCachePtr, m_bufferLen);
+              m_dirCachePtr += m_bufferLen;
+              repeat = false;
+            }
+          else if( !fromCache && f.openNext(&m_dir, O_RDONLY) )
+#else
           if( f.openNext(&m_dir, O_RDONLY) )
+#endif
             {
               uint16_t size = f.fileSize()==0 ? 0 : min(f.fileSize()/254+1, 9999);
               m_buffer[m_bufferLen++] = 1;
@@ -473,7 +598,7 @@ bool IECSD::readDir(uint8_t *data)
               if( n>0 )
                 {
                   toPETSCII((uint8_t *) m_buffer+m_bufferLen);
-                  if( m_dirPattern && !isMatch(m_buffer+m_bufferLen, m_dirPattern, FT_ANY) )
+                  if( m_dirPattern && !isMatch(m_buffer+m_bufferLen, m_dirMatch) )
                     n = 0;
                 }
 
@@ -510,6 +635,24 @@ bool IECSD::readDir(uint8_t *data)
                   while( m_bufferLen<31 ) m_buffer[m_bufferLen++] = ' ';
                   m_buffer[m_bufferLen++] = 0;
                   repeat = false;
+
+#if IECSD_DIRCACHE_SIZE>0
+                  if( m_dirCacheState==DC_FILLING )
+                    {
+                      if( m_dirCacheLen+m_bufferLen < IECSD_DIRCACHE_SIZE )
+                        {
+                          // add the entry to the directory cache
+                          m_dirCache[m_dirCacheLen++] = m_bufferLen;
+                          memcpy(m_dirCache+m_dirCacheLen, m_buffer, m_bufferLen);
+                          m_dirCacheLen += m_bufferLen;
+                        }
+                      else
+                        {
+                          // directory is too big for the cache
+                          m_dirCacheState = DC_INVALID;
+                        }
+                    }
+#endif
                 }
 
               f.close();
@@ -528,6 +671,13 @@ bool IECSD::readDir(uint8_t *data)
               m_bufferLen = 32;
               m_dir.close();
               repeat = false;
+#if IECSD_DIRCACHE_SIZE>0
+              // listing is complete => cache now holds all entries
+              if( m_dirCacheState==DC_FILLING || m_dirCacheState==DC_READING )
+                m_dirCacheState = DC_VALID;
+              else if( m_dirCacheState==DC_STALE )
+                m_dirCacheState = DC_INVALID;
+#endif
             }
         }
     } 
@@ -542,49 +692,193 @@ bool IECSD::readDir(uint8_t *data)
 }
 
 
-bool IECSD::isMatch(const char *name, const char *pattern, uint8_t ftypes)
+void IECSD::compilePattern(IECSDPattern &p, const char *pattern, uint8_t ftypes, bool multi)
+{
+  // split the pattern into its comma-separated parts (if "multi" is set) and determine
+  // for each part how many characters must be compared and whether there are wildcards,
+  // that way each name only needs to be compared up to the first differing character
+  p.num = 0;
+  p.ftypes = ftypes;
+  while( p.num<IECSD_MAX_PATTERNS )
+    {
+      // skip drive number (e.g. "S:A*,0:B*")
+      if( multi && p.num>0 && isdigit(pattern[0]) && pattern[1]==':' ) pattern += 2;
+
+      uint8_t i = 0;
+      bool wild = false;
+      while( pattern[i]!=0 && pattern[i]!='*' && !(multi && pattern[i]==',') )
+        {
+          wild |= pattern[i]=='?' || (pattern[i] & 0xFF)==0xFF;
+          i++;
+        }
+
+      p.part[p.num].text = pattern;
+      p.part[p.num].len  = i;
+      p.part[p.num].star = pattern[i]=='*';
+      p.part[p.num].wild = wild;
+      p.num++;
+
+      // anything after "*" is ignored
+      while( pattern[i]!=0 && !(multi && pattern[i]==',') ) i++;
+      if( pattern[i]==0 ) break;
+      pattern += i+1;
+    }
+}
+
+
+bool IECSD::isMatch(const char *name, const IECSDPattern &p)
 {
-  signed char found = -1;
+  for(uint8_t n=0; n<p.num; n++)
+    {
+      const char *pattern = p.part[n].text;
+      uint8_t len = p.part[n].len;
+
+      // compare characters up to "*" or end of pattern, stop at first difference
+      bool match = true;
+      if( !p.part[n].wild )
+        match = strncasecmp(name, pattern, len)==0;
+      else
+        for(uint8_t i=0; match && i<len; i++)
+          if( name[i]==0 || (pattern[i]!='?' && tolower(pattern[i])!=tolower(name[i]) && !(name[i]=='~' && (pattern[i] & 0xFF)==0xFF)) )
+            match = false;
+
+      if( !match )
+        continue;
+      else if( p.part[n].star || name[len]==0 )
+        return true;
+      else if( name[len]=='.' )
+        {
+          // pattern matches the name without extension => check file type
+          const char *ext = name+len+1;
+          if( p.ftypes==FT_ANY )
+            return true;
+          else if( (p.ftypes & FT_PRG) && strcasecmp_P(ext, PSTR("prg"))==0 )
+            return true;
+          else if( (p.ftypes & FT_SEQ) && strcasecmp_P(ext, PSTR("seq"))==0 )
+            return true;
+          else if( (p.ftypes & FT_REL) && strcasecmp_P(ext, PSTR("rel"))==0 )
+            return true;
+        }
+    }
+
+  return false;
+}
+
+
+bool IECSD::isMatch(SdFile &file, const IECSDPattern &p)
+{
+  // checks whether the file's long or short name matches, leaves the name in m_buffer
+  bool found = ((p.ftypes&FT_DIR)!=0 || !file.isDir()) && file.getName(m_buffer, IECSD_BUFSIZE) && isMatch(m_buffer, p);
+#if SDFAT_FILE_TYPE != 3
+  if( !found )
+    found = ((p.ftypes&FT_DIR)!=0 || !file.isDir()) && file.getSFN(m_buffer, IECSD_BUFSIZE) && isMatch(m_buffer, p);
+#endif
+  return found;
+}
+
+
+#if IECSD_NAMEINDEX_SIZE>0
+static uint16_t nameHash(const char *name)
+{
+  // hash over the case-folded name up to the first "." (i.e. without extension), 
+  // that way "NAME", "NAME.PRG" and "NAME.*" all have the same hash
+  uint16_t hash = 5381;
+  while( *name!=0 && *name!='.' ) hash = hash*33 + tolower(*name++);
+  return hash;
+}
+
 
-  for(uint8_t i=0; found<0; i++)
+void IECSD::addNameIndex(const char *name, uint16_t entry)
+{
+  if( m_nameIndexLen<IECSD_NAMEINDEX_SIZE )
+    {
+      m_nameIndex[m_nameIndexLen].hash  = nameHash(name);
+      m_nameIndex[m_nameIndexLen].first = tolower(name[0]);
+      m_nameIndex[m_nameIndexLen].entry = entry;
+      m_nameIndexLen++;
+    }
+  else
+    {
+      // directory is too big for the index
+      m_nameIndexState = NI_TOOLARGE;
+    }
+}
+
+
+void IECSD::buildNameIndex()
+{
+  // scan the directory (m_dir must be open) and remember the position of each entry,
+  // this is only done when the directory has changed since the last scan. If the
+  // directory does not fit into the index then it is not scanned again until it changes
+  uint32_t pos = 0;
+  m_nameIndexLen = 0;
+  m_nameIndexState = NI_VALID;
+  m_dir.rewind();
+  m_file.close();
+  while( m_nameIndexState==NI_VALID && m_file.openNext(&m_dir, O_RDONLY) )
     {
-      if( pattern[i]=='*' )
-        found = 1;
-      else if( pattern[i]==0 && name[i]=='.' )
+      if( pos/32 > 0xFFFF )
+        m_nameIndexState = NI_TOOLARGE;
+      else
         {
-          if( ftypes==FT_ANY )
-            found = 1;
-          else if( (ftypes & FT_PRG) && strcasecmp_P(name+i+1, PSTR("prg"))==0 )
-            found = 1;
-          else if( (ftypes & FT_SEQ) && strcasecmp_P(name+i+1, PSTR("seq"))==0 )
-            found = 1;
-          else
-            found = 0;
+          bool haveName = m_file.getName(m_buffer, IECSD_BUFSIZE)>0;
+          if( haveName ) addNameIndex(m_buffer, pos/32);
+#if SDFAT_FILE_TYPE != 3
+          // also add the short name if it differs
+          uint16_t hash = haveName ? nameHash(m_buffer) : 0;
+          if( m_file.getSFN(m_buffer, IECSD_BUFSIZE) && (!haveName || nameHash(m_buffer)!=hash) )
+            addNameIndex(m_buffer, pos/32);
+#endif
         }
-      else if( pattern[i]==0 || name[i]==0 )
-        found = (pattern[i]==name[i]) ? 1 : 0;
-      else if( pattern[i]!='?' && tolower(pattern[i])!=tolower(name[i]) && !(name[i]=='~' && (pattern[i] & 0xFF)==0xFF) )
-        found = 0;
+
+      m_file.close();
+      pos = m_dir.curPosition();
     }
 
-  return found==1;
+  m_dir.rewind();
 }
+#endif
 
 
 const char *IECSD::findFile(const char *pattern, uint8_t ftypes)
 {
   bool found = false;
+  IECSDPattern p;
+  compilePattern(p, pattern, ftypes, false);
 
   if( m_dir.openCwd() )
     {
       m_file.close();
-      while( !found && m_file.openNext(&m_dir, O_RDONLY) )
+#if IECSD_NAMEINDEX_SIZE>0
+      if( m_nameIndexState==NI_INVALID ) buildNameIndex();
+      if( m_nameIndexState==NI_VALID )
         {
-          found = ((ftypes&FT_DIR)!=0 || !m_file.isDir()) && m_file.getName(m_buffer, IECSD_BUFSIZE) && isMatch(m_buffer, pattern, ftypes);
-#if SDFAT_FILE_TYPE != 3
-          if( !found )
-            found = ((ftypes&FT_DIR)!=0 || !m_file.isDir()) && m_file.getSFN(m_buffer, IECSD_BUFSIZE) && isMatch(m_buffer, pattern, ftypes);
+          // if there are no wildcards before the first "." then only entries with
+          // the same hash can match, otherwise only check entries starting with the
+          // same character (unless the pattern starts with a wildcard)
+          const char *wildcard = strpbrk(pattern, "*?\xff");
+          const char *dot = strchr(pattern, '.');
+          bool useHash = wildcard==NULL || (dot!=NULL && dot<wildcard);
+          bool useFirst = pattern[0]!='*' && pattern[0]!='?' && (pattern[0] & 0xFF)!=0xFF;
+          uint16_t hash = nameHash(pattern);
+          char first = tolower(pattern[0]);
+
+          for(uint16_t i=0; !found && i<m_nameIndexLen; i++)
+            if( useHash ? m_nameIndex[i].hash==hash : (!useFirst || m_nameIndex[i].first==first) )
+              {
+                m_dir.seekSet(m_nameIndex[i].entry * 32ul);
+                if( m_file.openNext(&m_dir, O_RDONLY) )
+                  {
+                    found = isMatch(m_file, p);
+                    m_file.close();
+                  }
+              }
+        }
+      else
 #endif
+      while( !found && m_file.openNext(&m_dir, O_RDONLY) )
+        {
+          found = isMatch(m_file, p);
           m_file.close();
         }
       
@@ -597,9 +891,12 @@ const char *IECSD::findFile(const char *pattern, uint8_t ftypes)
 
 uint8_t IECSD::openFile(uint8_t channel, const char *constName)
 {
+  // use a free file handle (IECSD::open() makes sure there is one)
+  SdFile &file = *getFile(0xFF);
   uint8_t res = E_OK;
   char ftype = FT_PRG;
   char mode  = 'R';
+  uint8_t recordLen = 0;
   char namebuf[41];
   char *name = namebuf;
 
@@ -617,6 +914,17 @@ uint8_t IECSD::openFile(uint8_t channel, const char *constName)
       char cc = toupper(*(comma+1));
       if( cc=='R' || cc=='W' )
         mode = cc;
+#ifdef IECFILEDEVICE_SUPPORT_REL
+      else if( cc=='L' )
+        {
+          // relative file: "name,L,<record length>" (record length is binary so
+          // take it from the original name, not the PETSCII-converted copy)
+          ftype = FT_REL;
+          mode  = 'L';
+          comma = strchr(comma+1, ',');
+          if( comma!=NULL ) recordLen = constName[comma+1-namebuf];
+        }
+#endif
       else
         {
           if( cc=='S' )
@@ -634,11 +942,28 @@ uint8_t IECSD::openFile(uint8_t channel, const char *constName)
   else if( channel==1 )
     mode = 'W';
   
-  if( (ftype!=FT_PRG && ftype!=FT_SEQ) || (mode!='R' && mode!='W') )
+  if( (ftype!=FT_PRG && ftype!=FT_SEQ && ftype!=FT_REL) || (mode!='R' && mode!='W' && mode!='L') )
     res = E_INVNAME;
 
   if( res == E_OK )
     {
+#ifdef IECFILEDEVICE_SUPPORT_REL
+      if( mode=='L' )
+        {
+          if( name[0]==':' ) 
+            name++;
+          else if( name[0]!=0 && name[1]==':' )
+            name+=2;
+
+          // open existing relative file or create a new one
+          // (findFile also matches names without extension, those are not relative files)
+          const char *fn = findFile(name, FT_REL);
+          const char *ext = fn==NULL ? NULL : strrchr(fn, '.');
+          if( ext==NULL || strcasecmp_P(ext+1, PSTR("rel"))!=0 ) { strcat_P(name, PSTR(".rel")); fn = name; }
+          res = (channel<2) ? E_MISMATCH : openRelFile(file, channel, fn, recordLen);
+        }
+      else
+#endif
       if( mode=='R' )
         {
           if( name[0]==':' ) 
@@ -653,16 +978,16 @@ uint8_t IECSD::openFile(uint8_t channel, const char *constName)
 
           if( fn!=NULL )
             {
-              m_file.open(fn, O_RDONLY);
+              file.open(fn, O_RDONLY);
 #if SDFAT_FILE_TYPE == 1
-              if( !m_file.isOpen() ) m_file.openExistingSFN(fn);
+              if( !file.isOpen() ) file.openExistingSFN(fn);
 #endif
-              if( m_file.isOpen() )
+              if( file.isOpen() )
                 {
-                  if( m_file.isDir() )
+                  if( file.isDir() )
                     {
                       // the file is a directory => cd into it and open it
-                      m_file.close();
+                      file.close();
                       if( channel==0 )
                         {
                           chdir(name);
@@ -675,12 +1000,20 @@ uint8_t IECSD::openFile(uint8_t channel, const char *constName)
                   else if( (m_drive=VDrive::create(0, fn))!=NULL )
                     {
                       // the file is a mountable disk image => mount it and open its directory
-                      m_file.close();
+                      file.close();
                       if( channel==0 )
                         res = m_drive->openFile(channel, "$") ? E_OK : E_VDRIVE;
                       else
                         res = E_MISMATCH;
                     }
+#endif
+#ifdef IECFILEDEVICE_SUPPORT_REL
+                  else if( strrchr(fn, '.')!=NULL && strcasecmp_P(strrchr(fn, '.')+1, PSTR("rel"))==0 )
+                    {
+                      // relative file => re-open for reading and writing
+                      file.close();
+                      res = (channel<2) ? E_MISMATCH : openRelFile(file, channel, fn, 0);
+                    }
 #endif
                 }
               else
@@ -695,8 +1028,8 @@ uint8_t IECSD::openFile(uint8_t channel, const char *constName)
             res = E_NOTFOUND;
 
           // reject file if size is 0
-          if( m_file.isOpen() && (m_file.fileSize()==0) ) res = E_NOTFOUND;
-          if( res != E_OK ) m_file.close();
+          if( file.isOpen() && (file.fileSize()==0) ) res = E_NOTFOUND;
+          if( res != E_OK ) file.close();
         }
       else
         {
@@ -716,10 +1049,26 @@ uint8_t IECSD::openFile(uint8_t channel, const char *constName)
               m_dir.remove(name);
               m_dir.close();
             }
-          
+
+          // writing creates or changes a file => directory listing changes
+          invalidateDirCache();
+
           strcat_P(name, ftype==FT_PRG ? PSTR(".prg") : PSTR(".seq"));
-          if( m_file.open(name, O_WRONLY | O_CREAT | (overwrite ? O_TRUNC : O_EXCL)) )
-            res = E_OK;
+          if( file.open(name, O_WRONLY | O_CREAT | (overwrite ? O_TRUNC : O_EXCL)) )
+            {
+              res = E_OK;
+#if IECSD_WRITEBUFFER_SIZE>0
+              if( m_writeBufferChannel==0xFF )
+                {
+                  // use the write buffer for this file (and preallocate space)
+                  m_writeBufferChannel = channel;
+                  m_writeBufferLen = 0;
+#if IECSD_PREALLOCATE_SIZE>0
+                  file.preAllocate(IECSD_PREALLOCATE_SIZE);
+#endif
+                }
+#endif
+            }
           else
             {
               res = E_WRITE;
@@ -732,12 +1081,59 @@ uint8_t IECSD::openFile(uint8_t channel, const char *constName)
         }
     }
 
+  // assign the file handle to the channel
+  if( file.isOpen() ) m_fileChannel[&file-m_files] = channel;
   return res;
 }
 
 
+#ifdef IECFILEDEVICE_SUPPORT_REL
+uint8_t IECSD::openRelFile(SdFile &file, uint8_t channel, const char *name, uint8_t recordLen)
+{
+  // relative files are stored as "name.rel" with the first byte holding the record length,
+  // followed by the records. IECFileDevice handles positioning and record padding.
+  invalidateDirCache();
+  if( !file.open(name, O_RDWR | (recordLen>0 ? O_CREAT : 0)) )
+    return recordLen>0 ? E_WRITE : E_NOTFOUND;
+
+  uint8_t len = 0;
+  if( file.fileSize()==0 )
+    {
+      // new file => store record length
+      len = recordLen;
+      if( len==0 || file.write(&len, 1)!=1 ) { file.close(); return E_WRITE; }
+    }
+  else if( file.read(&len, 1)!=1 || len==0 || (recordLen>0 && recordLen!=len) )
+    {
+      // invalid file or record length does not match
+      file.close(); 
+      return E_MISMATCH;
+    }
+
+  setRecordLength(channel, len);
+  return E_OK;
+}
+
+
+uint32_t IECSD::seek(uint8_t channel, uint32_t pos)
+{
+  // skip the record length byte at the start of relative files
+  SdFile *file = getFile(channel);
+  if( file==NULL ) return 0;
+  pos = min(pos+1, (uint32_t) file->fileSize());
+  file->seekSet(pos);
+  return pos>0 ? pos-1 : 0;
+}
+#endif
+
+
 bool IECSD::open(uint8_t channel, const char *name, uint8_t nameLen)
 {
+#ifdef IECSD_EPYX_WRITE_BATCH
+  // normally done in epyxSectorOpsDone() already, make sure before the image can change
+  flushEpyxSectors();
+#endif
+
   if( !checkCard() )
     m_errorCode = E_NOTREADY;
 #ifdef HAVE_VDRIVE
@@ -746,12 +1142,15 @@ bool IECSD::open(uint8_t channel, const char *name, uint8_t nameLen)
 #endif
   else if( channel==0 && name[0]=='$' )
     m_errorCode = openDir(name+1);
-  else if ( !m_file )
-    m_errorCode = openFile(channel, name);
   else
     {
-      // we can only have one file open at a time
-      m_errorCode = E_TOOMANY;
+      // if the channel is still in use then close it first
+      closeFile(channel);
+
+      if( getFile(0xFF)!=NULL )
+        m_errorCode = openFile(channel, name);
+      else
+        m_errorCode = E_TOOMANY; // all file handles are in use
     }
 
   // clear the status buffer so getStatus() is called again next time the buffer is queried
@@ -763,6 +1162,8 @@ bool IECSD::open(uint8_t channel, const char *name, uint8_t nameLen)
 
 uint8_t IECSD::read(uint8_t channel, uint8_t *buffer, uint8_t bufferSize, bool *eoi)
 {
+  SdFile *file = getFile(channel);
+
 #ifdef HAVE_VDRIVE
   if( m_drive!=NULL && m_drive->isFileOk(channel) )
     {
@@ -777,8 +1178,32 @@ uint8_t IECSD::read(uint8_t channel, uint8_t *buffer, uint8_t bufferSize, bool *
     }
   else 
 #endif
-  if( m_file.isOpen() )
-    return m_file.read(buffer, bufferSize);
+#if IECSD_READBUFFER_SIZE>0
+  if( file!=NULL && !file->isWritable() && (m_readBufferChannel==channel || m_readBufferPtr==m_readBufferLen) )
+    {
+      // read buffer is either assigned to this channel or empty
+      if( m_readBufferChannel!=channel )
+        { m_readBufferChannel = channel; m_readBufferPtr = m_readBufferLen = 0; }
+
+      if( m_readBufferPtr==m_readBufferLen )
+        {
+          // refill the buffer, stopping at a sector boundary so that all following
+          // reads from the card are sector-aligned
+          int n = file->read(m_readBuffer, IECSD_READBUFFER_SIZE - (file->curPosition() % 512));
+          if( n<0 ) m_errorCode = E_READ;
+          m_readBufferLen = n>0 ? n : 0;
+          m_readBufferPtr = 0;
+        }
+
+      uint8_t n = min(bufferSize, m_readBufferLen-m_readBufferPtr);
+      memcpy(buffer, m_readBuffer+m_readBufferPtr, n);
+      m_readBufferPtr += n;
+      return n;
+    }
+  else
+#endif
+  if( file!=NULL )
+    return file->read(buffer, bufferSize);
   else
     return readDir(buffer) ? 1 : 0;
 }
@@ -786,6 +1211,8 @@ uint8_t IECSD::read(uint8_t channel, uint8_t *buffer, uint8_t bufferSize, bool *
 
 uint8_t IECSD::write(uint8_t channel, uint8_t *buffer, uint8_t bufferSize, bool eoi)
 {
+  SdFile *file = getFile(channel);
+
 #ifdef HAVE_VDRIVE
   if( m_drive!=NULL && m_drive->isFileOk(channel) )
     {
@@ -800,8 +1227,39 @@ uint8_t IECSD::write(uint8_t channel, uint8_t *buffer, uint8_t bufferSize, bool
     }
   else 
 #endif
-  if( m_file.isOpen() )
-    return m_file.write(buffer, bufferSize);
+  if( file!=NULL )
+    {
+      // the data may be passed on only after the computer has finished sending
+      // (UNLISTEN or CLOSE), report errors through the status channel
+      invalidateDirCache(false);
+
+#if IECSD_WRITEBUFFER_SIZE>0
+      if( m_writeBufferChannel==channel )
+        {
+          // collect data in the write buffer and write it to the card in whole sectors
+          uint8_t n = 0;
+          while( n<bufferSize )
+            {
+              uint16_t l = min(bufferSize-n, IECSD_WRITEBUFFER_SIZE-m_writeBufferLen);
+              memcpy(m_writeBuffer+m_writeBufferLen, buffer+n, l);
+              m_writeBufferLen += l;
+              n += l;
+              if( m_writeBufferLen==IECSD_WRITEBUFFER_SIZE && !flushWriteBuffer() ) return 0;
+            }
+
+          return n;
+        }
+#endif
+
+      size_t n = file->write(buffer, bufferSize);
+      if( n!=bufferSize )
+        {
+          m_errorCode = E_WRITE;
+          return n<bufferSize ? n : 0;
+        }
+
+      return n;
+    }
   else
     return 0;
 }
@@ -819,13 +1277,103 @@ void IECSD::close(uint8_t channel)
     }
   else 
 #endif
-  if( m_dir )
+  if( !closeFile(channel) && m_dir )
     { 
       m_dir.close();
       m_bufferLen = 0;
     }
-  else 
-    m_file.close(); 
+}
+
+
+SdFile *IECSD::getFile(uint8_t channel)
+{
+  // returns the file handle assigned to the given channel (NULL if none),
+  // channel 0xFF returns a free file handle
+  for(uint8_t i=0; i<IECSD_MAX_FILES; i++)
+    if( m_fileChannel[i]==channel )
+      return m_files+i;
+
+  return NULL;
+}
+
+
+void IECSD::invalidateDirCache(bool namesChanged)
+{
+#if IECSD_DIRCACHE_SIZE>0
+  // a listing that is currently being served from the cache is finished first
+  m_dirCacheState = (m_dirCacheState==DC_READING || m_dirCacheState==DC_STALE) ? DC_STALE : DC_INVALID;
+#endif
+#if IECSD_NAMEINDEX_SIZE>0
+  // file names only change when files are created/deleted or the directory changes
+  if( namesChanged ) m_nameIndexState = NI_INVALID;
+#endif
+}
+
+
+bool IECSD::closeFile(uint8_t channel)
+{
+  // closes the file on the given channel (returns false if there was none)
+  SdFile *file = getFile(channel);
+  if( file==NULL ) return false;
+
+#if IECSD_WRITEBUFFER_SIZE>0
+  if( m_writeBufferChannel==channel )
+    {
+      // write remaining data and free unused preallocated space
+      flushWriteBuffer();
+      file->truncate();
+      m_writeBufferChannel = 0xFF;
+
+      // a cached directory listing would show the preallocated size
+      invalidateDirCache(false);
+    }
+#endif
+
+  file->close();
+  m_fileChannel[file-m_files] = 0xFF;
+#if IECSD_READBUFFER_SIZE>0
+  if( m_readBufferChannel==channel ) { m_readBufferChannel = 0xFF; m_readBufferPtr = m_readBufferLen = 0; }
+#endif
+  return true;
+}
+
+
+#if IECSD_WRITEBUFFER_SIZE>0
+bool IECSD::flushWriteBuffer()
+{
+  // write the data collected in the write buffer to the file, report errors through 
+  // the status channel
+  SdFile *file = getFile(m_writeBufferChannel);
+  bool ok = true;
+  if( file!=NULL && m_writeBufferLen>0 && file->write(m_writeBuffer, m_writeBufferLen)!=m_writeBufferLen )
+    {
+      m_errorCode = E_WRITE;
+      ok = false;
+    }
+
+  m_writeBufferLen = 0;
+  return ok;
+}
+#endif
+
+
+void IECSD::closeAllFiles()
+{
+#if IECSD_WRITEBUFFER_SIZE>0
+  // make sure buffered data gets written
+  if( m_writeBufferChannel!=0xFF ) closeFile(m_writeBufferChannel);
+#endif
+
+  for(uint8_t i=0; i<IECSD_MAX_FILES; i++)
+    {
+      m_files[i].close();
+      m_fileChannel[i] = 0xFF;
+    }
+
+#if IECSD_READBUFFER_SIZE>0
+  m_readBufferChannel = 0xFF;
+  m_readBufferPtr = m_readBufferLen = 0;
+#endif
 }
 
 
@@ -913,6 +1461,11 @@ void IECSD::executeData(const uint8_t *data, uint8_t len)
 
 void IECSD::execute(const char *command)
 {
+#ifdef IECSD_EPYX_WRITE_BATCH
+  // normally done in epyxSectorOpsDone() already, make sure before the image can change
+  flushEpyxSectors();
+#endif
+
   if( strncmp_P(command, PSTR("CD"),2)==0 )
     {
       // "CD" command: if there is a colon then ignore anything before (and including) the colon
@@ -921,21 +1474,25 @@ void IECSD::execute(const char *command)
     }
   else if( strncmp(command, "S:", 2)==0 )
     {
+      invalidateDirCache();
       if( m_dir.openCwd() )
         {
-          char pattern[17];
+          // multiple patterns can be given, e.g. "S:A*,B*"
+          char pattern[41];
+          IECSDPattern p;
           m_errorCode = E_SCRATCHED;
           m_scratched = 0;
 
-          strncpy(pattern, command+2, 16);
-          pattern[16]=0;
+          strncpy(pattern, command+2, 40);
+          pattern[40]=0;
           fromPETSCII((uint8_t *) pattern);
+          compilePattern(p, pattern, FT_NODIR, true);
           
           while( m_file.openNext(&m_dir, O_RDONLY) )
             {
               size_t n = m_file.getName(m_buffer, IECSD_BUFSIZE);
               m_file.close();
-              if( n>0 && isMatch(m_buffer, pattern, FT_NODIR) && m_dir.remove(m_buffer) )
+              if( n>0 && isMatch(m_buffer, p) && m_dir.remove(m_buffer) )
                 m_scratched++;
             }
           
@@ -957,6 +1514,7 @@ void IECSD::execute(const char *command)
           memset(diskname, 0, 17);
           strncpy(diskname, imagename, (dot-imagename)<16 ? (dot-imagename) : 16);
 
+          invalidateDirCache();
           m_dir.openCwd();
           if( m_dir.exists(imagename) )
             m_errorCode = E_EXISTS;
@@ -973,6 +1531,7 @@ void IECSD::execute(const char *command)
       strncpy(m_buffer, command+3, IECSD_BUFSIZE);
       m_buffer[IECSD_BUFSIZE-1]=0;
       fromPETSCII((uint8_t *) m_buffer);
+      invalidateDirCache();
 
       if( command[0]=='M' )
         m_errorCode = m_sd.mkdir(m_buffer, true) ? E_OK : E_EXISTS;
@@ -981,9 +1540,11 @@ void IECSD::execute(const char *command)
     }
   else if( strcmp(command, "I")==0 || strcmp_P(command, PSTR("X+\x0dUJ"))==0 )
     {
-      m_dir.close();
-      m_file.close();
+      // closing files may report a (deferred) write error
       m_errorCode = E_OK;
+      m_dir.close();
+      closeAllFiles();
+      invalidateDirCache();
     }
   else if( command[0]=='X' || command[0]=='E' )
     {
@@ -1004,7 +1565,7 @@ void IECSD::execute(const char *command)
             m_errorCode = E_INVCMD;
         }
       else if( command[0]=='D' && isdigit(command[1]) )
-        m_dirFormat = command[1]-'0';
+        { m_dirFormat = command[1]-'0'; invalidateDirCache(false); }
       else if( command[0]=='E' && isdigit(command[1]) )
         m_suppressMemExeError = command[1]=='0';
       else if( command[0]=='R' && isdigit(command[1]) )
@@ -1110,6 +1671,10 @@ void IECSD::reset()
 
       IECFileDevice::reset();
 
+      // close files before re-initializing the card so buffered data gets written
+      closeAllFiles();
+      m_dir.close();
+
       m_cardOk = false;
       m_errorCode = E_SPLASH;
 #ifdef HAVE_VDRIVE
@@ -1124,8 +1689,7 @@ void IECSD::reset()
       else
         m_errorCode = E_NOTREADY;
 
-      m_file.close();
-      m_dir.close();
+      invalidateDirCache();
 
       if( m_pinLED<0xFF )
         {
@@ -18,6 +18,99 @@
 #define IECSD_BUFSIZE   96
 #define IECSD_MAX_PATH 128
 
+// maximum number of files that can be open at the same time (on different channels)
+#if defined(__AVR__)
+#define IECSD_MAX_FILES  1
+#else
+#define IECSD_MAX_FILES  4
+#endif
+
+// size of the RAM cache holding the rendered directory listing of the current directory.
+// Repeated LOAD"$" (without a file name pattern) are then served from RAM instead of
+// reading the directory from the SD card again. The cache is invalidated whenever files
+// are created, written or scratched, directories are created/removed or the current
+// directory changes. Each entry takes about 33 bytes, directories that do not fit are
+// not cached. Set to 0 to disable.
+#if defined(__AVR__)
+#define IECSD_DIRCACHE_SIZE 0
+#else
+#define IECSD_DIRCACHE_SIZE 8192
+#endif
+
+// maximum number of entries in the file name index of the current directory.
+// With the index, looking up a file by name (LOAD, OPEN, SAVE) only needs to check
+// entries whose name (without extension) has the same hash instead of scanning the
+// whole directory. The index is rebuilt on the next lookup after the directory
+// has changed. Requires 6 bytes per entry, directories with more entries are scanned
+// as before. Set to 0 to disable.
+#if defined(__AVR__)
+#define IECSD_NAMEINDEX_SIZE 0
+#else
+#define IECSD_NAMEINDEX_SIZE 512
+#endif
+
+// size of the read buffer used when loading files. Data is read from the SD card in
+// whole sectors (512 bytes, multi-sector reads if this is a multiple of 512) and handed
+// out from RAM, regardless of how many bytes the bus side asks for at a time.
+// Only one channel (usually the file being loaded) uses the buffer at a time,
+// files opened for writing (including REL files) are never buffered.
+// Must be a multiple of 512, set to 0 to disable.
+#if defined(__AVR__)
+#define IECSD_READBUFFER_SIZE 0
+#else
+#define IECSD_READBUFFER_SIZE 1024
+#endif
+
+// size of the write buffer used when saving files. Data received from the bus is
+// collected and written to the SD card in whole sectors (must be a multiple of 512).
+// Only one file (the first one opened for writing) uses the buffer at a time.
+// Set to 0 to disable.
+#if defined(__AVR__)
+#define IECSD_WRITEBUFFER_SIZE 0
+#else
+#define IECSD_WRITEBUFFER_SIZE 512
+#endif
+
+// when opening a file for writing (and the write buffer is used), try to allocate
+// this many bytes of contiguous space on the card up-front so the FAT does not need
+// to be searched/updated while data is being received. Unused space is freed when the
+// file is closed. Set to 0 to disable.
+#define IECSD_PREALLOCATE_SIZE 65536
+
+// number of sectors written by Epyx FastLoad sector operations (e.g. disk copy) that are
+// collected in RAM (256 bytes each) and written to the mounted disk image in one go once
+// the computer has finished (see IECDevice::epyxSectorOpsDone). This keeps the SD card
+// accesses out of the short gaps between sector commands. Sectors are also written
+// when the buffer is full. Only used if HAVE_VDRIVE is defined. Set to 0 to disable.
+#if defined(__AVR__)
+#define IECSD_EPYX_WRITE_SECTORS 0
+#else
+#define IECSD_EPYX_WRITE_SECTORS 21
+#endif
+
+// convenience macro, IECSD_EPYX_WRITE_BATCH is defined if Epyx sector writes are collected
+#if defined(IEC_FP_EPYX) && defined(IEC_FP_EPYX_SECTOROPS) && defined(HAVE_VDRIVE) && IECSD_EPYX_WRITE_SECTORS>0
+#define IECSD_EPYX_WRITE_BATCH
+#endif
+
+// maximum number of comma-separated patterns in directory listings and
+// scratch commands (e.g. "S:A*,B*")
+#define IECSD_MAX_PATTERNS 4
+
+// file name pattern compiled by IECSD::compilePattern()
+struct IECSDPattern
+{
+  uint8_t num, ftypes;
+  struct
+  {
+    const char *text; // start of pattern text (not 0-terminated if there are multiple patterns)
+    uint8_t len;      // number of characters to compare (up to "*" or end of pattern)
+    bool star;        // pattern ends with "*" => only compare first "len" characters
+    bool wild;        // first "len" characters contain "?" or shifted-space (0xFF) wildcards
+  } part[IECSD_MAX_PATTERNS];
+};
+
+
 class IECSD : public IECFileDevice
 {
  public: 
@@ -36,18 +129,44 @@ class IECSD : public IECFileDevice
   virtual void executeData(const uint8_t *data, uint8_t len);
   virtual void execute(const char *command);
   virtual void reset();
+#ifdef IECFILEDEVICE_SUPPORT_REL
+  virtual uint32_t seek(uint8_t channel, uint32_t pos);
+#endif
 
 #if defined(IEC_FP_EPYX) && defined(IEC_FP_EPYX_SECTOROPS) && defined(HAVE_VDRIVE)
   virtual bool epyxReadSector(uint8_t track, uint8_t sector, uint8_t *buffer);
   virtual bool epyxWriteSector(uint8_t track, uint8_t sector, uint8_t *buffer);
+  virtual void epyxSectorOpsDone();
 #endif
 
  private:
+#ifdef IECSD_EPYX_WRITE_BATCH
+  bool flushEpyxSectors();
+  uint8_t m_epyxSectorData[IECSD_EPYX_WRITE_SECTORS][256];
+  uint8_t m_epyxTrack[IECSD_EPYX_WRITE_SECTORS], m_epyxSector[IECSD_EPYX_WRITE_SECTORS], m_epyxNumSectors;
+#endif
+
   bool checkCard();
   uint8_t openFile(uint8_t channel, const char *name);
   uint8_t openDir(const char *pattern);
+#ifdef IECFILEDEVICE_SUPPORT_REL
+  uint8_t openRelFile(SdFile &file, uint8_t channel, const char *name, uint8_t recordLen);
+#endif
+  SdFile *getFile(uint8_t channel);
+  bool closeFile(uint8_t channel);
+#if IECSD_WRITEBUFFER_SIZE>0
+  bool flushWriteBuffer();
+#endif
+  void closeAllFiles();
+  void invalidateDirCache(bool namesChanged = true);
   bool readDir(uint8_t *data);
-  bool isMatch(const char *name, const char *pattern, uint8_t extmatch);
+  void compilePattern(IECSDPattern &p, const char *pattern, uint8_t ftypes, bool multi);
+  bool isMatch(const char *name, const IECSDPattern &p);
+  bool isMatch(SdFile &file, const IECSDPattern &p);
+#if IECSD_NAMEINDEX_SIZE>0
+  void buildNameIndex();
+  void addNameIndex(const char *name, uint16_t entry);
+#endif
   void toPETSCII(uint8_t *name);
   void fromPETSCII(uint8_t *name);
 
@@ -55,8 +174,10 @@ class IECSD : public IECFileDevice
   const char *findFile(const char *name, uint8_t ftype);
 
   SdFat m_sd;
-  SdFile m_file, m_dir;
+  SdFile m_file, m_dir, m_files[IECSD_MAX_FILES];
+  uint8_t m_fileChannel[IECSD_MAX_FILES];
   char m_cwd[IECSD_MAX_PATH+1], *m_dirPattern;
+  IECSDPattern m_dirMatch;
   bool m_cardOk;
 
 #ifdef HAVE_VDRIVE
@@ -67,6 +188,27 @@ class IECSD : public IECFileDevice
   uint8_t m_bufferLen, m_bufferPtr, m_dirFormat;
   bool m_suppressMemExeError, m_suppressReset;
   char m_buffer[IECSD_BUFSIZE];
+
+#if IECSD_DIRCACHE_SIZE>0
+  uint8_t m_dirCache[IECSD_DIRCACHE_SIZE], m_dirCacheState;
+  uint16_t m_dirCacheLen, m_dirCachePtr;
+#endif
+
+#if IECSD_READBUFFER_SIZE>0
+  uint8_t m_readBuffer[IECSD_READBUFFER_SIZE], m_readBufferChannel;
+  uint16_t m_readBufferLen, m_readBufferPtr;
+#endif
+
+#if IECSD_WRITEBUFFER_SIZE>0
+  uint8_t m_writeBuffer[IECSD_WRITEBUFFER_SIZE], m_writeBufferChannel;
+  uint16_t m_writeBufferLen;
+#endif
+
+#if IECSD_NAMEINDEX_SIZE>0
+  struct { uint16_t hash, entry; char first; } m_nameIndex[IECSD_NAMEINDEX_SIZE];
+  uint16_t m_nameIndexLen;
+  uint8_t m_nameIndexState;
+#endif
 };
 
 #endif
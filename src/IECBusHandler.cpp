@@ -61,6 +61,7 @@
 #define timer_less_than(us)  (TCNT1L < ((uint8_t) (2*(us))))
 #define timer_not_equal(us)  (TCNT1L != uint8_t(uint32_t(2*(us))))
 #define timer_wait_until(us) while( timer_not_equal(us) )
+#define timer_wait_until_hus(hus) while( TCNT1L != uint8_t(hus) )
 #else
 // use 8-bit timer 2 with /8 prescaler
 #define timer_init()         { TCCR2A=0; TCCR2B=0; }
@@ -70,6 +71,7 @@
 #define timer_less_than(us)  (TCNT2 < ((uint8_t) (2*(us))))
 #define timer_not_equal(us)  (TCNT2 != uint8_t(uint16_t(2*(us))))
 #define timer_wait_until(us) while( timer_not_equal(us) )
+#define timer_wait_until_hus(hus) while( TCNT2 != uint8_t(hus) )
 #endif
 
 //NOTE: Must disable IEC_FP_DOLPHIN/IEC_FP_SPEEDDOS, otherwise no pins left for debugging (except Mega)
@@ -96,6 +98,7 @@ static uint16_t timer_ticks_diff(uint16_t t0, uint16_t t1) { return ((t0 < t1) ?
 #define timer_stop()         while(0)
 #define timer_less_than(us)  (timer_ticks_diff(timer_start_ticks, R_AGT0->AGT) < ((int) ((us)*3)))
 #define timer_wait_until(us) while( timer_less_than(us) )
+#define timer_wait_until_hus(hus) while( timer_ticks_diff(timer_start_ticks, R_AGT0->AGT) < ((int) (hus)*3/2) )
 
 #ifdef JDEBUG
 #define JDEBUGI() pinMode(1, OUTPUT)
@@ -117,6 +120,7 @@ static uint32_t timer_ticks_diff(uint32_t t0, uint32_t t1) { return ((t0 < t1) ?
 #define timer_stop()         while(0)
 #define timer_less_than(us)  (timer_ticks_diff(timer_start_ticks, SysTick->VAL) < ((int) ((us)*84)))
 #define timer_wait_until(us) while( timer_less_than(us) )
+#define timer_wait_until_hus(hus) while( timer_ticks_diff(timer_start_ticks, SysTick->VAL) < ((int) (hus)*42) )
 
 #ifdef JDEBUG
 #define JDEBUGI() pinMode(2, OUTPUT)
@@ -136,6 +140,7 @@ static unsigned long timer_start_us;
 #define timer_stop()         while(0)
 #define timer_less_than(us)  ((time_us_32()-timer_start_us) < ((int) ((us)+0.5)))
 #define timer_wait_until(us) while( timer_less_than(us) )
+#define timer_wait_until_hus(hus) while( (time_us_32()-timer_start_us)*2 < (uint32_t) (hus) )
 
 #ifdef JDEBUG
 #define JDEBUGI() pinMode(28, OUTPUT)
@@ -166,6 +171,9 @@ static DRAM_ATTR esp_cpu_cycle_count_t timer_start_cycles, timer_cycles_per_us_d
 #define timer_wait_until(us) \
   { esp_cpu_cycle_count_t to = uint32_t((us)*2) * timer_cycles_per_us_div2; \
     while( (esp_cpu_get_cycle_count()-timer_start_cycles) < to ); }
+#define timer_wait_until_hus(hus) \
+  { esp_cpu_cycle_count_t to = uint32_t(hus) * timer_cycles_per_us_div2; \
+    while( (esp_cpu_get_cycle_count()-timer_start_cycles) < to ); }
 
 // interval in which we need to feed the interrupt WDT to stop it from re-booting the system
 #define IWDT_FEED_TIME ((CONFIG_ESP_INT_WDT_TIMEOUT_MS-50)*1000)
@@ -194,6 +202,7 @@ static unsigned long timer_start_us;
 #define timer_stop()         while(0)
 #define timer_less_than(us)  ((micros()-timer_start_us) < ((int) ((us)+0.5)))
 #define timer_wait_until(us) while( timer_less_than(us) )
+#define timer_wait_until_hus(hus) while( (micros()-timer_start_us)*2 < (uint32_t) (hus) )
 
 #if defined(JDEBUG) && defined(ESP_PLATFORM)
 #define JDEBUGI() pinMode(26, OUTPUT)
@@ -245,6 +254,12 @@ static unsigned long timer_start_us;
 #define RAMFUNC(name) name
 #endif
 
+// On ESP32, constant data used by time-critical code (such as the bit schedule tables)
+// must be placed in DRAM for the same reason, DRAM_ATTR is empty for other platforms
+#ifndef DRAM_ATTR
+#define DRAM_ATTR
+#endif
+
 // delayMicroseconds on some platforms does not work if called when interrupts are disabled
 // => define a version that does work on all supported platforms
 static void RAMFUNC(delayMicrosecondsISafe)(uint16_t t)
@@ -273,6 +288,51 @@ static void RAMFUNC(delayMicrosecondsISafe)(uint16_t t)
 #define digitalReadFastExtIEC(pin, reg, bit) (digitalReadFastExt(pin, reg, bit))
 #endif
 
+#ifdef IEC_SUPPORT_HOST_CALIBRATION
+// Wait until the given time (specified in microseconds for a stock C64) has passed,
+// scaled according to the host speed measured in calibrateHostTiming().
+// m_hostTimingFactor is 64 for a stock host, in which case this results in exactly
+// the same wait time as timer_wait_until(us). The scaled time is computed once before
+// entering the wait loop, otherwise a slow loop iteration (the AVR version checks for
+// equality) could miss the timer tick and wait for a full timer wrap-around
+#define timer_wait_until_host(us) \
+  { uint16_t hus_ = (uint16_t(2*(us)) * m_hostTimingFactor) >> 6; timer_wait_until_hus(hus_); }
+
+// Time (in microseconds) for which a stock C64 keeps CLK high when transmitting a
+// bit under ATN: CLK is set high by the STA in the CLKHI routine ($EE85) and set low
+// again 26 cycles later at $ED5F (RTS + 4xNOP + LDA/AND/ORA/STA)
+#define HOST_CLK_PULSE_STOCK 26
+
+// measureCLKHighTime() only starts measuring some time after CLK went high
+// (waitPinCLK, reading the DATA bit, starting the timer), this is added
+// to the measured time
+#define HOST_CLK_PULSE_OFFSET 2
+
+// CLK pulses shorter than this (in microseconds) are not plausible (even a host
+// running at HOST_SPEED_MAX would take longer) and are ignored
+#define HOST_CLK_PULSE_MIN 5
+
+// number of consecutive bytes that must result in (roughly) the same host speed
+// before the timing is changed, and how far apart (in 1/16 of a stock C64)
+// measurements may be to be considered the same
+#define HOST_CALIBRATION_BYTES     4
+#define HOST_CALIBRATION_TOLERANCE 2
+
+// Host speed is measured in 1/16 of the speed of a stock C64. Hosts measured to be
+// less than 1.5 times faster than a stock C64 use the stock timing (the measurement
+// has some jitter and some kernals use slightly different timing). The upper limit
+// is given by how quickly we can toggle the CLK/DATA lines.
+#define HOST_SPEED_STOCK 16
+#define HOST_SPEED_MIN   24
+#if defined(__AVR__)
+#define HOST_SPEED_MAX   32
+#else
+#define HOST_SPEED_MAX   64
+#endif
+#else
+#define timer_wait_until_host(us) timer_wait_until(us)
+#endif
+
 // -----------------------------------------------------------------------------------------
 
 #define P_ATN        0x80
@@ -286,6 +346,7 @@ static void RAMFUNC(delayMicrosecondsISafe)(uint16_t t)
 #define S_DOLPHIN_DETECTED       0x04  // Detected DolphinDos request from host
 #define S_DOLPHIN_BURST_ENABLED  0x08  // DolphinDos burst mode is enabled
 #define S_SPEEDDOS_DETECTED      0x10  // Detected SpeedDos request from host
+#define S_EPYX_SECTOROPS         0x20  // Epyx sector operations in progress (epyxSectorOpsDone not yet called)
 
 #define TC_NONE      0
 #define TC_DATA_LOW  1
@@ -631,6 +692,22 @@ IECBusHandler::IECBusHandler(uint8_t pinATN, uint8_t pinCLK, uint8_t pinDATA, ui
   m_pinDATAout   = pinDATAout;
 #endif
 
+#if defined(IEC_FP_JIFFY) || defined(IEC_FP_DOLPHIN)
+  m_bufferLen    = 0;
+#endif
+
+#ifdef IEC_FP_EPYX
+  m_epyxTalking  = false;
+#endif
+
+#ifdef IEC_SUPPORT_HOST_CALIBRATION
+  m_hostSpeed    = HOST_SPEED_STOCK;
+  m_hostSpeedFixed = false;
+  m_hostTimingFactor = 64;
+  m_hostSpeedCandidate = HOST_SPEED_STOCK;
+  m_hostSpeedCount = 0;
+#endif
+
 #if defined(IEC_SUPPORT_FASTLOAD)
 #if IEC_DEFAULT_FASTLOAD_BUFFER_SIZE>254
   m_bufferSize = 254;
@@ -1062,8 +1139,9 @@ void IECBusHandler::enableParallelPins()
 #else
       SPI.begin();
 #endif
-      setParallelBusModeInput();
       m_inTransaction = 0;
+      m_parallelBusMode = 0x00; // force GCR1 update in setParallelBusModeInput()
+      setParallelBusModeInput();
 #else
       for(int i=0; i<8; i++) pinMode(m_pinParallel[i], INPUT);
 #endif
@@ -1192,7 +1270,12 @@ void RAMFUNC(IECBusHandler::writeParallelData)(uint8_t data)
 void RAMFUNC(IECBusHandler::setParallelBusModeInput)()
 {
 #ifdef IEC_SUPPORT_PARALLEL_XRA1405
-  XRA1405_WriteReg(0x06, 0xFF); // GCR1, GPIO Configuration Register for P0-P7
+  // skip the SPI transfer if the XRA1405 pins are already configured as inputs
+  if( m_parallelBusMode!=0xFF )
+    {
+      XRA1405_WriteReg(0x06, 0xFF); // GCR1, GPIO Configuration Register for P0-P7
+      m_parallelBusMode = 0xFF;
+    }
 #else
   // set parallel bus data pins to input mode
   for(int i=0; i<8; i++) 
@@ -1204,7 +1287,12 @@ void RAMFUNC(IECBusHandler::setParallelBusModeInput)()
 void RAMFUNC(IECBusHandler::setParallelBusModeOutput)()
 {
 #ifdef IEC_SUPPORT_PARALLEL_XRA1405
-  XRA1405_WriteReg(0x06, 0x00); // GCR1, GPIO Configuration Register for P0-P7
+  // skip the SPI transfer if the XRA1405 pins are already configured as outputs
+  if( m_parallelBusMode!=0x00 )
+    {
+      XRA1405_WriteReg(0x06, 0x00); // GCR1, GPIO Configuration Register for P0-P7
+      m_parallelBusMode = 0x00;
+    }
 #else
   // set parallel bus data pins to output mode
   for(int i=0; i<8; i++) 
@@ -1424,6 +1512,197 @@ void IECBusHandler::fastLoadRequest(IECDevice *dev, uint8_t protocol, uint8_t re
 }
 
 
+uint8_t IECBusHandler::getActiveFastLoader(IECDevice *dev)
+{
+  // returns the fast-load protocol (IEC_FP_*) currently used for transfers
+  // with the given device, 0xFF if none (i.e. standard IEC protocol)
+  if( dev->m_flProtocol!=IEC_FL_PROT_NONE )
+    return dev->m_flProtocol >> 3;
+#ifdef IEC_FP_JIFFY
+  else if( dev->m_flFlags & S_JIFFY_DETECTED )
+    return IEC_FP_JIFFY;
+#endif
+#ifdef IEC_FP_DOLPHIN
+  else if( dev->m_flFlags & S_DOLPHIN_DETECTED )
+    return IEC_FP_DOLPHIN;
+#endif
+#ifdef IEC_FP_SPEEDDOS
+  else if( dev->m_flFlags & S_SPEEDDOS_DETECTED )
+    return IEC_FP_SPEEDDOS;
+#endif
+
+  return 0xFF;
+}
+
+
+#ifdef IEC_SUPPORT_HOST_CALIBRATION
+
+// ------------------------------------  Host timing calibration  ------------------------------------
+
+
+void IECBusHandler::setHostSpeed(uint8_t speed)
+{
+  // speed is given in 1/16 of a stock C64 (i.e. 32 means twice as fast),
+  // 0 means to (re-)enable automatic calibration
+  m_hostSpeedFixed = speed>0;
+  m_hostSpeedCount = 0;
+  setHostTiming(speed>0 ? speed : HOST_SPEED_STOCK);
+}
+
+
+uint8_t IECBusHandler::getHostSpeed()
+{
+  return m_hostSpeed;
+}
+
+
+void IECBusHandler::setHostTiming(uint16_t speed)
+{
+  if( speed<HOST_SPEED_MIN )
+    speed = HOST_SPEED_STOCK;
+  else if( speed>HOST_SPEED_MAX )
+    speed = HOST_SPEED_MAX;
+
+  m_hostSpeed = speed;
+
+  // timing factor is given in 1/64, i.e. 64 for a stock C64 and 32 for
+  // a host running at twice the speed (see timer_wait_until_host macro)
+  m_hostTimingFactor = (64*HOST_SPEED_STOCK + speed/2) / speed;
+}
+
+
+void IECBusHandler::calibrateHostTiming(uint8_t pulse)
+{
+  // "pulse" is the shortest time (in microseconds) measured by measureCLKHighTime()
+  // while the host was transmitting the bits of a byte under ATN
+  if( m_hostSpeedFixed ) return;
+
+  pulse += HOST_CLK_PULSE_OFFSET;
+  if( pulse<HOST_CLK_PULSE_MIN ) return;
+
+  uint16_t speed = (16*HOST_CLK_PULSE_STOCK + pulse/2) / pulse;
+  if( speed<HOST_SPEED_MIN )
+    speed = HOST_SPEED_STOCK;
+  else if( speed>HOST_SPEED_MAX )
+    speed = HOST_SPEED_MAX;
+
+  // only change the timing after several consecutive bytes resulted in the
+  // same speed, a single bad measurement should not break fast-load transfers
+  if( m_hostSpeedCount>0 && abs(int(speed)-int(m_hostSpeedCandidate))<=HOST_CALIBRATION_TOLERANCE )
+    {
+      if( m_hostSpeedCount<HOST_CALIBRATION_BYTES && ++m_hostSpeedCount==HOST_CALIBRATION_BYTES )
+        setHostTiming(m_hostSpeedCandidate);
+    }
+  else
+    {
+      m_hostSpeedCandidate = speed;
+      m_hostSpeedCount = 1;
+    }
+}
+
+
+void IECBusHandler::resetHostTiming()
+{
+  // forget previous calibration and start over with stock timing
+  m_hostSpeedCount = 0;
+  if( !m_hostSpeedFixed ) setHostTiming(HOST_SPEED_STOCK);
+}
+
+
+uint8_t RAMFUNC(IECBusHandler::measureCLKHighTime)()
+{
+  // returns the time (in microseconds) until CLK goes low, at most 100
+  uint8_t t = 0;
+  timer_init();
+  timer_reset();
+  timer_start();
+  while( readPinCLK() && t<100 )
+    if( !timer_less_than(t+1) ) t++;
+  timer_stop();
+
+  return t;
+}
+
+#endif
+
+
+#if defined(IEC_FP_EPYX) || defined(IEC_FP_HYPRALOAD)
+
+// ------------------------------------  Bit schedule support  ------------------------------------
+
+// A bit schedule describes how a clocked fast-load protocol puts the bits of a byte
+// onto the CLK and DATA lines. For each step, the bits selected by the "clk" and "data"
+// masks are written to CLK and DATA, then we wait until "hus" half-microseconds have
+// passed since the timer was started. If "reset" is set, the timer is restarted
+// after waiting (needed for schedules longer than 127us since the AVR timer is 8 bit).
+// The timer must be initialized and started by the caller.
+struct BitScheduleStep { uint8_t clk, data, hus, reset; };
+
+#pragma GCC push_options
+#pragma GCC optimize ("O2")
+
+void RAMFUNC(IECBusHandler::transmitBitSchedule)(uint8_t data, const struct BitScheduleStep *schedule, uint8_t numSteps)
+{
+  // the bits for the next step are prepared before waiting so the
+  // CLK/DATA outputs change as soon as possible after the wait is over
+  bool clk = data & schedule->clk, dat = data & schedule->data;
+  for(uint8_t i=0; i<numSteps; i++)
+    {
+      JDEBUG0();
+      writePinCLK(clk);
+      writePinDATA(dat);
+      JDEBUG1();
+
+      uint8_t hus = schedule->hus, reset = schedule->reset;
+      if( i+1<numSteps ) { schedule++; clk = data & schedule->clk; dat = data & schedule->data; }
+
+      timer_wait_until_hus(hus);
+      if( reset ) timer_reset();
+    }
+}
+
+#pragma GCC pop_options
+
+#endif
+
+
+#if defined(IEC_FP_JIFFY) || defined(IEC_FP_DOLPHIN)
+
+// ------------------------------------  Receive buffer  ------------------------------------
+
+
+bool IECBusHandler::receiveBufferedByte(uint8_t data, bool eoi)
+{
+  // collect data received on a data channel in the buffer and pass it on to the
+  // device in one go once the buffer is full or the sender signals EOI.
+  // Data for the command channel and file names (OPEN) are passed on byte-by-byte,
+  // as is all data for devices that have not enabled buffered writes (those rely
+  // on canWrite() being called before each byte is acknowledged)
+  if( (m_secondary & 0xF0)!=0x60 || (m_secondary & 0x0F)==15 || m_bufferSize==0 || !m_currentDevice->m_bufferedWrite )
+    {
+      m_currentDevice->write(data, eoi);
+      return true;
+    }
+
+  m_buffer[m_bufferLen++] = data;
+  if( m_bufferLen>=m_bufferSize || eoi )
+    return flushReceiveBuffer(eoi);
+
+  return true;
+}
+
+
+bool IECBusHandler::flushReceiveBuffer(bool eoi)
+{
+  // pass data collected by receiveBufferedByte on to the device
+  uint8_t n = m_bufferLen;
+  m_bufferLen = 0;
+  return n==0 || m_currentDevice->write(m_buffer, n, eoi)==n;
+}
+
+#endif
+
+
 #ifdef IEC_FP_JIFFY
 
 // ------------------------------------  JiffyDos support routines  ------------------------------------  
@@ -1522,15 +1801,15 @@ bool RAMFUNC(IECBusHandler::receiveJiffyByte)(bool canWriteOk)
   if( canWriteOk )
     {
       // pass received data on to the device
-      m_currentDevice->write(data, eoi);
+      // (we are holding DATA low so the sender will wait for us)
+      return receiveBufferedByte(data, eoi);
     }
   else
     {
-      // canWrite() reported an error
+      // canWrite() reported an error => discard data received so far and exit
+      m_bufferLen = 0;
       return false;
     }
-  
-  return true;
 }
 
 
@@ -1577,7 +1856,7 @@ bool RAMFUNC(IECBusHandler::transmitJiffyByte)(uint8_t numData)
   // bits 0+1 are read by receiver 16 cycles after DATA HIGH (FBD5)
 
   // wait until 16.5 us after DATA
-  timer_wait_until(16.5);
+  timer_wait_until_host(16.5);
   
   JDEBUG0();
   writePinCLK(data & bit(2));
@@ -1586,7 +1865,7 @@ bool RAMFUNC(IECBusHandler::transmitJiffyByte)(uint8_t numData)
   // bits 2+3 are read by receiver 26 cycles after DATA HIGH (FBDB)
 
   // wait until 27.5 us after DATA
-  timer_wait_until(27.5);
+  timer_wait_until_host(27.5);
 
   JDEBUG0();
   writePinCLK(data & bit(4));
@@ -1595,7 +1874,7 @@ bool RAMFUNC(IECBusHandler::transmitJiffyByte)(uint8_t numData)
   // bits 4+5 are read by receiver 37 cycles after DATA HIGH (FBE2)
 
   // wait until 39 us after DATA
-  timer_wait_until(39);
+  timer_wait_until_host(39);
 
   JDEBUG0();
   writePinCLK(data & bit(6));
@@ -1604,7 +1883,7 @@ bool RAMFUNC(IECBusHandler::transmitJiffyByte)(uint8_t numData)
   // bits 6+7 are read by receiver 48 cycles after DATA HIGH (FBE9)
 
   // wait until 50 us after DATA
-  timer_wait_until(50);
+  timer_wait_until_host(50);
   JDEBUG0();
       
   // numData:
@@ -1626,13 +1905,13 @@ bool RAMFUNC(IECBusHandler::transmitJiffyByte)(uint8_t numData)
     }
 
   // EOI/error status is read by receiver 59 cycles after DATA HIGH (FBEF)
-  timer_wait_until(61);
+  timer_wait_until_host(61);
 
   JDEBUG1();
   if( numData==1 )
     {
       writePinDATA(HIGH);   // make sure DATA is released after signaling EOI
-      timer_wait_until(65); // give it time to settle
+      timer_wait_until_host(65); // give it time to settle
     }
 
   // receiver signals "done" by pulling DATA low (FBF2)
@@ -1737,7 +2016,7 @@ bool RAMFUNC(IECBusHandler::transmitJiffyBlock)(uint8_t *buffer, uint8_t numByte
 
       // receiver expects to see CLK high at 4 cycles after DATA LOW (FB54)
       // wait until 6 us after DATA LOW
-      timer_wait_until(6);
+      timer_wait_until_host(6);
 
       JDEBUG0();
       writePinCLK(data & bit(0));
@@ -1746,7 +2025,7 @@ bool RAMFUNC(IECBusHandler::transmitJiffyBlock)(uint8_t *buffer, uint8_t numByte
       // bits 0+1 are read by receiver 16 cycles after DATA LOW (FB5D)
 
       // wait until 17 us after DATA LOW
-      timer_wait_until(17);
+      timer_wait_until_host(17);
   
       JDEBUG0();
       writePinCLK(data & bit(2));
@@ -1755,7 +2034,7 @@ bool RAMFUNC(IECBusHandler::transmitJiffyBlock)(uint8_t *buffer, uint8_t numByte
       // bits 2+3 are read by receiver 26 cycles after DATA LOW (FB63)
 
       // wait until 27 us after DATA LOW
-      timer_wait_until(27);
+      timer_wait_until_host(27);
 
       JDEBUG0();
       writePinCLK(data & bit(4));
@@ -1764,7 +2043,7 @@ bool RAMFUNC(IECBusHandler::transmitJiffyBlock)(uint8_t *buffer, uint8_t numByte
       // bits 4+5 are read by receiver 37 cycles after DATA LOW (FB6A)
 
       // wait until 39 us after DATA LOW
-      timer_wait_until(39);
+      timer_wait_until_host(39);
 
       JDEBUG0();
       writePinCLK(data & bit(6));
@@ -1773,7 +2052,7 @@ bool RAMFUNC(IECBusHandler::transmitJiffyBlock)(uint8_t *buffer, uint8_t numByte
       // bits 6+7 are read by receiver 48 cycles after DATA LOW (FB71)
 
       // wait until 50 us after DATA LOW
-      timer_wait_until(50);
+      timer_wait_until_host(50);
     }
 
   // signal "not ready" by pulling CLK LOW
@@ -1815,7 +2094,7 @@ bool IECBusHandler::receiveDolphinByte(bool canWriteOk)
 
   // we have buffered bytes (see comment below) that need to be
   // sent on to the higher level handler before we can receive more.
-  // There are two ways to get to m_bufferCtr==PARALLEL_PREBUFFER_BYTES:
+  // There are two ways to get to m_bufferCtr<=PARALLEL_PREBUFFER_BYTES:
   // 1) the host never sends a XZ burst request and just keeps sending data
   // 2) the host sends a burst request but we reject it
   // note that we must wait for the host to be ready to send the next data 
@@ -1823,10 +2102,20 @@ bool IECBusHandler::receiveDolphinByte(bool canWriteOk)
   // it before the host sends the burst (XZ) request
   if( m_secondary==0x61 && m_bufferCtr > 0 && m_bufferCtr <= PARALLEL_PREBUFFER_BYTES )
     {
-      // send next buffered byte on to higher level
-      m_currentDevice->write(m_buffer[m_bufferCtr-1], false);
-      m_bufferCtr--;
-      return true;
+      if( m_currentDevice->m_bufferedWrite )
+        {
+          // the buffered bytes are at the start of m_buffer, just make them
+          // the first bytes of the data to be passed on to the device
+          m_bufferLen = m_bufferCtr;
+          m_bufferCtr = 0;
+        }
+      else
+        {
+          // send next buffered byte on to higher level
+          m_currentDevice->write(m_buffer[PARALLEL_PREBUFFER_BYTES-m_bufferCtr], false);
+          m_bufferCtr--;
+          return true;
+        }
     }
 
   noInterrupts();
@@ -1874,21 +2163,23 @@ bool IECBusHandler::receiveDolphinByte(bool canWriteOk)
       // so we only do the buffering in that case. 
       if( m_secondary==0x61 && m_bufferCtr > PARALLEL_PREBUFFER_BYTES )
         {
-          m_buffer[m_bufferCtr-PARALLEL_PREBUFFER_BYTES-1] = data;
+          m_buffer[2*PARALLEL_PREBUFFER_BYTES-m_bufferCtr] = data;
           m_bufferCtr--;
         }
       else
         {
           // pass received data on to the device
-          m_currentDevice->write(data, eoi);
+          // (we are holding DATA low so the sender will wait for us)
+          return receiveBufferedByte(data, eoi);
         }
 
       return true;
     }
   else
     {
-      // canWrite reported an error
+      // canWrite reported an error => discard data received so far and exit
       interrupts();
+      m_bufferLen = 0;
       return false;
     }
 }
@@ -1982,11 +2273,12 @@ bool IECBusHandler::receiveDolphinBurst()
   parallelBusHandshakeTransmit();
 
   // keep going while CLK is low
-  bool eoi = false;
-  while( !eoi )
+  bool eoi = false, ok = true;
+  startParallelTransaction();
+  while( !eoi && ok )
     {
       // wait for "data ready" handshake, return if ATN is asserted (high)
-      if( !waitParallelBusHandshakeReceived() ) return false;
+      if( !waitParallelBusHandshakeReceived() ) { endParallelTransaction(); return false; }
 
       // CLK=high means EOI ("final byte of data coming")
       eoi = readPinCLK();
@@ -1999,21 +2291,33 @@ bool IECBusHandler::receiveDolphinBurst()
           // data received and buffered  => send handshake
           parallelBusHandshakeTransmit();
         }
-      else if( m_currentDevice->write(m_buffer, n, eoi)==n )
-        {
-          // data written successfully => send handshake
-          parallelBusHandshakeTransmit();
-          n = 0;
-        }
       else
         {
-          // error while writing data => release DATA to signal error condition and exit
-          writePinDATA(HIGH);
-          return false;
+          // end the parallel bus transaction while the device is busy, the device 
+          // may be using the same SPI bus as the XRA1405 (e.g. for an SD card)
+          endParallelTransaction();
+
+          // only acknowledge the final byte of a block after the device has
+          // written it, otherwise the host would consider the byte delivered
+          // even if the device reports an error
+          if( m_currentDevice->write(m_buffer, n, eoi)==n )
+            {
+              // data written successfully => send handshake
+              parallelBusHandshakeTransmit();
+            }
+          else
+            ok = false;
+
+          startParallelTransaction();
+          n = 0;
         }
     }
+  endParallelTransaction();
 
-  return true;
+  // if there was an error while writing data then release DATA to signal error condition
+  if( !ok ) writePinDATA(HIGH);
+
+  return ok;
 }
 
 
@@ -2038,6 +2342,7 @@ bool IECBusHandler::transmitDolphinBurst()
   // the transmission has started. The kernal does so after the first two bytes
   // were sent, MultiDubTwo after one byte. After swtiching to burst mode, the 1541
   // then re-transmits the bytes that were already sent.
+  startParallelTransaction();
   for(uint8_t i=0; i<m_bufferCtr; i++)
     {
       // put data on bus
@@ -2050,8 +2355,9 @@ bool IECBusHandler::transmitDolphinBurst()
       interrupts();
 
       // wait for received handshake
-      if( !waitParallelBusHandshakeReceived() ) { setParallelBusModeInput(); return false; }
+      if( !waitParallelBusHandshakeReceived() ) { setParallelBusModeInput(); endParallelTransaction(); return false; }
     }
+  endParallelTransaction();
 
   // get data from the device and transmit it
   uint8_t n;
@@ -2279,22 +2585,27 @@ bool IECBusHandler::transmitSpeedDosFile()
   // The fast-load then re-transmits the bytes that were already sent.
   uint8_t offset = m_bufferCtr;
 
-  // get remaining data from the device and transmit it
+  // get remaining data from the device and transmit it, each block is read
+  // from the device in one call (filling the whole buffer) and the parallel bus 
+  // transaction is only released while the device is reading (the device may be
+  // sharing the SPI bus with the XRA1405)
   uint8_t n;
   while( (n=m_currentDevice->read(m_buffer+offset, m_bufferSize-offset)+offset)>0 )
     {
       startParallelTransaction();
       if( !transmitSpeedDosParallelByte(n+1) )
-        { setParallelBusModeInput(); return false; }
+        { setParallelBusModeInput(); endParallelTransaction(); return false; }
 
       for(uint8_t i=0; i<n; i++) 
         if( !transmitSpeedDosParallelByte(m_buffer[i]) )
-          { setParallelBusModeInput(); return false; }
+          { setParallelBusModeInput(); endParallelTransaction(); return false; }
 
       endParallelTransaction();
       offset = 0;
     }
 
+  startParallelTransaction();
+
   // block length of 0 signifies end-of-data
   transmitSpeedDosParallelByte(0);
 
@@ -2304,6 +2615,8 @@ bool IECBusHandler::transmitSpeedDosFile()
   // switch parallel bus back to input
   setParallelBusModeInput();
 
+  endParallelTransaction();
+
   return true;
 }
 
@@ -2368,41 +2681,13 @@ bool RAMFUNC(IECBusHandler::transmitEpyxByte)(uint8_t data)
   // abort if ATN low
   if( !readPinATN() ) { JDEBUG0(); return false; }
 
-  JDEBUG0();
-  writePinCLK(data & bit(7));
-  writePinDATA(data & bit(5));
-  JDEBUG1();
-  // bits 5+7 are read by receiver 15 cycles after DATA HIGH
-
-  // wait until 17 us after DATA
-  timer_wait_until(17);
-
-  JDEBUG0();
-  writePinCLK(data & bit(6));
-  writePinDATA(data & bit(4));
-  JDEBUG1();
-  // bits 4+6 are read by receiver 25 cycles after DATA HIGH
-
-  // wait until 27 us after DATA
-  timer_wait_until(27);
-
-  JDEBUG0();
-  writePinCLK(data & bit(3));
-  writePinDATA(data & bit(1));
-  JDEBUG1();
-  // bits 1+3 are read by receiver 35 cycles after DATA HIGH
-
-  // wait until 37 us after DATA
-  timer_wait_until(37);
-
-  JDEBUG0();
-  writePinCLK(data & bit(2));
-  writePinDATA(data & bit(0));
-  JDEBUG1();
-  // bits 0+2 are read by receiver 45 cycles after DATA HIGH
-
-  // wait until 47 us after DATA
-  timer_wait_until(47);
+  // bits 5+7 are read by receiver 15 cycles after DATA HIGH => change at 17us
+  // bits 4+6 are read by receiver 25 cycles after DATA HIGH => change at 27us
+  // bits 1+3 are read by receiver 35 cycles after DATA HIGH => change at 37us
+  // bits 0+2 are read by receiver 45 cycles after DATA HIGH => change at 47us
+  static const DRAM_ATTR struct BitScheduleStep schedule[4] = 
+    {{bit(7), bit(5), 2*17, 0}, {bit(6), bit(4), 2*27, 0}, {bit(3), bit(1), 2*37, 0}, {bit(2), bit(0), 2*47, 0}};
+  transmitBitSchedule(data, schedule, 4);
 
   // release DATA and give it time to stabilize, also some
   // buffer time if we got slightly delayed when waiting before
@@ -2478,10 +2763,30 @@ bool RAMFUNC(IECBusHandler::startEpyxSectorCommand)(uint8_t command)
   m_buffer[2] = sector;
 
   m_currentDevice->fastLoadRequest(IEC_FP_EPYX, IEC_FL_PROT_SECTOR);
+  m_currentDevice->m_flFlags |= S_EPYX_SECTOROPS;
   return true;
 }
 
 
+void IECBusHandler::finishEpyxSectorOps(bool reset)
+{
+  // call the device's epyxSectorOpsDone() function once a sequence of sector operations
+  // has ended, no matter whether the host stopped sending commands, timed out,
+  // aborted via ATN (atnRequest clears m_flProtocol) or the bus was reset.
+  // Must be called from task context with m_inTask==false.
+  for(uint8_t i=0; i<m_numDevices; i++)
+    {
+      IECDevice *dev = m_devices[i];
+      if( (dev->m_flFlags & S_EPYX_SECTOROPS)!=0 && (reset || dev->m_flProtocol!=((IEC_FP_EPYX<<3)|IEC_FL_PROT_SECTOR)) )
+        {
+          if( reset ) dev->m_flProtocol = IEC_FL_PROT_NONE;
+          dev->m_flFlags &= ~S_EPYX_SECTOROPS;
+          dev->epyxSectorOpsDone();
+        }
+    }
+}
+
+
 bool RAMFUNC(IECBusHandler::finishEpyxSectorCommand)()
 {
   // this was set in receiveEpyxSectorCommand
@@ -2634,6 +2939,9 @@ bool RAMFUNC(IECBusHandler::receiveEpyxHeader)()
           // finish DOS OPEN command in the device
           m_currentDevice->unlisten();
 
+          // channel will be selected when transmitting the first block
+          m_epyxTalking = false;
+
           m_currentDevice->fastLoadRequest(IEC_FP_EPYX, IEC_FL_PROT_LOAD);
           return true;
         }
@@ -2662,8 +2970,14 @@ bool RAMFUNC(IECBusHandler::receiveEpyxHeader)()
 
 bool RAMFUNC(IECBusHandler::transmitEpyxBlock)()
 {
-  // set channel number for read() call below
-  m_currentDevice->talk(0);
+  // set channel number for read() calls below, only necessary before the
+  // first block since the host does not send any commands until the
+  // transfer is finished (and an ATN request aborts the transfer)
+  if( !m_epyxTalking )
+    {
+      m_currentDevice->talk(0);
+      m_epyxTalking = true;
+    }
 
   // get data
   m_inTask = false;
@@ -2748,22 +3062,22 @@ void RAMFUNC(IECBusHandler::transmitFC3Bytes)(uint8_t *data)
   writePinCLK( b & bit(0));     \
   writePinDATA(b & bit(1));     \
   JDEBUG1();                    \
-  timer_wait_until(t);          \
+  timer_wait_until_host(t);     \
   JDEBUG0();                    \
   writePinCLK( b & bit(2));     \
   writePinDATA(b & bit(3));     \
   JDEBUG1();                    \
-  timer_wait_until(t+13);       \
+  timer_wait_until_host(t+13);  \
   JDEBUG0();                    \
   writePinCLK( b & bit(4));     \
   writePinDATA(b & bit(5));     \
   JDEBUG1();                    \
-  timer_wait_until(t+25);       \
+  timer_wait_until_host(t+25);  \
   JDEBUG0();                    \
   writePinCLK( b & bit(6));     \
   writePinDATA(b & bit(7));     \
   JDEBUG1();                    \
-  timer_wait_until(t+37);
+  timer_wait_until_host(t+37);
 
   timer_init();
   timer_reset();
@@ -2776,7 +3090,7 @@ void RAMFUNC(IECBusHandler::transmitFC3Bytes)(uint8_t *data)
   timer_start();
 
   // make sure the C64 has seen our CLK low
-  timer_wait_until(8);
+  timer_wait_until_host(8);
 
 #if defined(__AVR__)
   // On AVR we need to start TRANSMIT_BYTE early because of the slow processor
@@ -2866,7 +3180,6 @@ bool RAMFUNC(IECBusHandler::receiveFC3Byte)(uint8_t *pdata)
 
 int8_t RAMFUNC(IECBusHandler::transmitFC3Block)()
 {
-  m_inTask = false;
   if( m_buffer[1]==0 )
     {
       // first block => we need only 252 bytes since
@@ -2877,21 +3190,13 @@ int8_t RAMFUNC(IECBusHandler::transmitFC3Block)()
       // If there are more blocks to transmit then n must be 0, otherwise it must
       // be one more than the number of data bytes in this block 
       // (n+3 because of the repeated load address)
+      m_inTask = false;
       uint8_t n = m_currentDevice->read(m_buffer+5, 253);
       m_buffer[2] = (n==253) ? 0 : n+3;
-    }
-  else
-    {
-      // second or later block => move the extra data byte that was read before to the beginning
-      // and attempt to read 254 more bytes (one byte more than needed for this block).
-      // If there is more data (i.e. blocks) to transmit then n must be 0, otherwise it must
-      // be one more than the number of data bytes in this block (n+1 because of the extra data byte)
-      m_buffer[3] = m_buffer[257];
-      uint8_t n = m_currentDevice->read(m_buffer+4, 254);
-      m_buffer[2] = (n==254) ? 0 : n+2;
+      m_inTask = true;
     }
 
-  m_inTask = true;
+  // (data for second or later blocks was read while transmitting the previous block)
 
   // if ATN was asserted then done
   if( m_flags & P_ATN ) return -1;
@@ -2916,11 +3221,47 @@ int8_t RAMFUNC(IECBusHandler::transmitFC3Block)()
   // byte 2: number of valid data bytes in block (0=full block of 254 bytes)
   // byte 3-256: 254 data bytes in block
   // byte 257-259: not used by receiver
-  uint8_t *data = m_buffer;
+  // If there is a next block then we read its data in the gaps between the
+  // 4-byte tuples, placing it in the part of the buffer that has already been
+  // transmitted. The receiver waits for CLK low before each tuple so it does
+  // not matter if a gap gets longer than necessary.
+  bool more = m_buffer[2]==0, eoi = false;
+  uint8_t n = 0, *data = m_buffer;
   for(int i=0; i<65; i++)
     {
-      // wait to give receiver time to get ready for next data segment
-      delayMicrosecondsISafe(150);
+      if( more && i>0 )
+        {
+          uint32_t t = micros();
+
+          // move the extra data byte that was read before to the beginning,
+          // bytes 0-3 have been transmitted now
+          if( i==1 ) m_buffer[3] = m_buffer[257];
+
+          // read as much of the next block as fits into the transmitted part of the buffer
+          if( !eoi && i>1 )
+            {
+              uint8_t nn = 4*i-4-n;
+              interrupts();
+              m_inTask = false;
+              uint8_t nr = m_currentDevice->read(m_buffer+4+n, nn);
+              m_inTask = true;
+              noInterrupts();
+              if( nr<nn ) eoi = true;
+              n += nr;
+
+              // if ATN was asserted while reading then abort
+              if( m_flags & P_ATN ) { interrupts(); return -1; }
+            }
+
+          // wait to give receiver time to get ready for next data segment
+          t = micros()-t;
+          if( t<150 ) delayMicrosecondsISafe(150-t);
+        }
+      else
+        {
+          // wait to give receiver time to get ready for next data segment
+          delayMicrosecondsISafe(150);
+        }
 
       // transmit 4-byte tuple
       transmitFC3Bytes(data);
@@ -2931,15 +3272,27 @@ int8_t RAMFUNC(IECBusHandler::transmitFC3Block)()
 
   // release CLK, signal end-of-data by pulling DATA low if this was the last block
   writePinCLK(HIGH);
-  writePinDATA(m_buffer[2]==0 ? HIGH : LOW);
+  writePinDATA(more ? HIGH : LOW);
 
   // increment block number
   m_buffer[1]++;
 
   interrupts();
 
+  if( more )
+    {
+      // read the remainder of the next block, attempting to read 254 bytes
+      // (one byte more than needed for the block). If there are more blocks
+      // to transmit then n must be 0, otherwise it must be one more than the number
+      // of data bytes in this block (n+2 because of the extra data byte)
+      m_inTask = false;
+      if( !eoi ) n += m_currentDevice->read(m_buffer+4+n, 254-n);
+      m_buffer[2] = (n==254) ? 0 : n+2;
+      m_inTask = true;
+    }
+
   // return true if more blocks to transmit
-  return m_buffer[2]==0;
+  return more;
 }
 
 
@@ -3076,25 +3429,25 @@ bool RAMFUNC(IECBusHandler::transmitAR6Byte)(uint8_t data, bool ar6Protocol)
       writePinDATA(data & bit(1));
       JDEBUG1();
       // receiver reads bits 0(CLK) and 1(DATA) 10us after DATA high
-      timer_wait_until(12);
+      timer_wait_until_host(12);
       JDEBUG0();
       writePinCLK( data & bit(2));
       writePinDATA(data & bit(3));
       JDEBUG1();
       // receiver reads bits 2(CLK) and 3(DATA) 18us after DATA high
-      timer_wait_until(20);
+      timer_wait_until_host(20);
       JDEBUG0();
       writePinCLK( data & bit(4));
       writePinDATA(data & bit(5));
       JDEBUG1();
       // receiver reads bits 4(CLK) and 5(DATA) 26us after DATA high
-      timer_wait_until(28);
+      timer_wait_until_host(28);
       JDEBUG0();
       writePinCLK( data & bit(6));
       writePinDATA(data & bit(7));
       JDEBUG1();
       // receiver reads bits 4(CLK) and 5(DATA) 34us after DATA high
-      timer_wait_until(36);
+      timer_wait_until_host(36);
     }
   else
     {
@@ -3106,25 +3459,25 @@ bool RAMFUNC(IECBusHandler::transmitAR6Byte)(uint8_t data, bool ar6Protocol)
       writePinDATA(data & bit(5));
       JDEBUG1();
       // receiver reads bits 7(CLK) and 5(DATA) 16us after DATA high
-      timer_wait_until(18);
+      timer_wait_until_host(18);
       JDEBUG0();
       writePinCLK( data & bit(6));
       writePinDATA(data & bit(4));
       JDEBUG1();
       // receiver reads bits 6(CLK) and 4(DATA) 26us after DATA high
-      timer_wait_until(28);
+      timer_wait_until_host(28);
       JDEBUG0();
       writePinCLK( data & bit(3));
       writePinDATA(data & bit(1));
       JDEBUG1();
       // receiver reads bits 3(CLK) and 1(DATA) 36us after DATA high
-      timer_wait_until(38);
+      timer_wait_until_host(38);
       JDEBUG0();
       writePinCLK( data & bit(2));
       writePinDATA(data & bit(0));
       JDEBUG1();
       // receiver reads bits 2(CLK) and 0(DATA) 46us after DATA high
-      timer_wait_until(48);
+      timer_wait_until_host(48);
     }
 
   // pull CLK low ("not ready") and release DATA
@@ -3252,6 +3605,12 @@ int8_t RAMFUNC(IECBusHandler::receiveAR6Block)()
   uint8_t n   = eoi ? m_buffer[1]-2 : 254;
 
   // send data to device
+  // CLK is low ("not ready") at this point and the sender does not start the
+  // next block before we release CLK (in receiveAR6Byte), so writing the data
+  // now overlaps with whatever the computer does to prepare the next block.
+  // Writing "behind" the next block would only move this time to the gaps between
+  // the next block's bytes (each byte is clocked with interrupts disabled) and 
+  // would delay reporting a write error until the next block has been received.
   m_inTask = false;
   bool ok = m_currentDevice->write(m_buffer+2, n, eoi)==n;
   m_inTask = true;
@@ -3296,31 +3655,14 @@ bool RAMFUNC(IECBusHandler::transmitHypraLoadByte)(uint8_t data)
   timer_reset();
   timer_start();
 
-  JDEBUG0();
-  writePinCLK( data & bit(0));
-  writePinDATA(data & bit(1));
-  JDEBUG1();
   // receiver reads bits 0(CLK) and 1(DATA) 40us after ATN high
-  timer_wait_until(45);
-  JDEBUG0();
-  writePinCLK( data & bit(2));
-  writePinDATA(data & bit(3));
-  JDEBUG1();
   // receiver reads bits 2(CLK) and 3(DATA) 64us after ATN high
-  timer_wait_until(75);
-  JDEBUG0();
-  writePinCLK( data & bit(4));
-  writePinDATA(data & bit(5));
-  JDEBUG1();
   // receiver reads bits 4(CLK) and 5(DATA) 89us after ATN high
-  timer_wait_until(100);
-  timer_reset();
-  JDEBUG0();
-  writePinCLK( data & bit(6));
-  writePinDATA(data & bit(7));
-  JDEBUG1();
   // receiver reads bits 6(CLK) and 7(DATA) 113us after ATN high
-  timer_wait_until(30); // 130us since ATN
+  // (timer is reset at 100us, so the final wait ends 130us after ATN)
+  static const DRAM_ATTR struct BitScheduleStep schedule[4] = 
+    {{bit(0), bit(1), 2*45, 0}, {bit(2), bit(3), 2*75, 0}, {bit(4), bit(5), 2*100, 1}, {bit(6), bit(7), 2*30, 0}};
+  transmitBitSchedule(data, schedule, 4);
   JDEBUG0();
 
   // signal "not ready"
@@ -3334,7 +3676,8 @@ bool RAMFUNC(IECBusHandler::transmitHypraLoadByte)(uint8_t data)
 bool IECBusHandler::transmitHypraLoadBlock()
 {
   // generally, 254 data bytes are read into m_buffer[1..254]
-  // buffer[0]=0 serves as a flag to signal whether we're reading the first sector
+  // buffer[0]=0 serves as a flag to signal whether we're reading the first sector,
+  // for later sectors it holds the number of bytes read for the sector.
   // we read one more byte than needed for the sector to see if we need to send
   // another sector after this. The extra byte will be at m_buffer[255] and
   // will not be sent until the next data block
@@ -3346,15 +3689,11 @@ bool IECBusHandler::transmitHypraLoadBlock()
       // regular IEC protocol but the fast loader expects a full 254-byte block. However,
       // it discards the first two butes of data so we can just send any values
       n = m_currentDevice->read(m_buffer+3, 253) + 2;
-      m_buffer[0] = 0xFF;
     }
   else
     {
-      // get extra byte from previous block
-      m_buffer[1] = m_buffer[255];
-
-      // read the next 254 bytes (extra byte will end up in m_buffer[255])
-      n = m_currentDevice->read(m_buffer+2, 254) + 1;
+      // data for this sector was read while transmitting the previous sector
+      n = m_buffer[0];
     }
 
   // 0x00 signals success, 0xFF signals error condition
@@ -3374,8 +3713,37 @@ bool IECBusHandler::transmitHypraLoadBlock()
     }
 
   // transmit sector data bytes (2-256)
+  // If there is another sector after this one then read its data in chunks while 
+  // transmitting, placing it in the part of the buffer that has already been sent.
+  // The receiver waits for DATA high ("ready") before each byte so reading in
+  // between bytes only makes the gap between those bytes longer.
+  bool eoi = false;
+  uint8_t m = 0;
   for(uint8_t i=1; i<=254; i++)
-    transmitHypraLoadByte(m_buffer[i]);
+    {
+      transmitHypraLoadByte(m_buffer[i]);
+
+      if( n==255 && i==1 )
+        {
+          // get extra byte from previous block
+          m_buffer[1] = m_buffer[255];
+          m = 1;
+        }
+      else if( n==255 && (i&31)==0 && !eoi )
+        {
+          // read next sector data into m_buffer[m+1..i]
+          uint8_t nr = m_currentDevice->read(m_buffer+m+1, i-m);
+          if( nr<i-m ) eoi = true;
+          m += nr;
+        }
+    }
+
+  if( n==255 )
+    {
+      // read the remaining bytes of the next sector (extra byte will end up in m_buffer[255])
+      if( !eoi ) m += m_currentDevice->read(m_buffer+m+1, 255-m);
+      m_buffer[0] = m;
+    }
 
   // return true if there are more blocks to transmit
   return n==255;
@@ -3469,6 +3837,9 @@ bool RAMFUNC(IECBusHandler::receiveIECByteATN)(uint8_t &data, uint8_t bytenum)
 
   // receive data bits
   data = 0;
+#ifdef IEC_SUPPORT_HOST_CALIBRATION
+  uint8_t pulse = 0xFF;
+#endif
   for(uint8_t i=0; i<8; i++)
     {
       JDEBUG1();
@@ -3502,6 +3873,13 @@ bool RAMFUNC(IECBusHandler::receiveIECByteATN)(uint8_t &data, uint8_t bytenum)
       data >>= 1;
       if( readPinDATA() ) data |= 0x80;
 
+#ifdef IEC_SUPPORT_HOST_CALIBRATION
+      // measure how long the host keeps CLK high, take the shortest time
+      // over all bits (VIC "bad lines" may stretch some of them)
+      uint8_t t = measureCLKHighTime();
+      if( t<pulse ) pulse = t;
+#endif
+
       // wait for CLK=0, signaling "data not ready"
       if( !waitPinCLK(LOW) ) return false;
     }
@@ -3509,6 +3887,12 @@ bool RAMFUNC(IECBusHandler::receiveIECByteATN)(uint8_t &data, uint8_t bytenum)
   // Acknowledge receipt by pulling DATA low
   writePinDATA(LOW);
 
+#ifdef IEC_SUPPORT_HOST_CALIBRATION
+  // adjust fast-load timing to the host's speed (measurement is only valid
+  // if CLK went low within the measurement period)
+  if( pulse<100 ) calibrateHostTiming(pulse);
+#endif
+
 #if defined(IEC_FP_DOLPHIN)
   // DolphinDos parallel cable detection:
   // after receiving secondary address, wait for either:
@@ -3868,6 +4252,9 @@ void RAMFUNC(IECBusHandler::handleATNSequence)()
 #ifdef IEC_FP_DOLPHIN
               // see comments in function receiveDolphinByte
               if( m_secondary==0x61 ) m_bufferCtr = 2*PARALLEL_PREBUFFER_BYTES;
+#endif
+#if defined(IEC_FP_JIFFY) || defined(IEC_FP_DOLPHIN)
+              m_bufferLen = 0;
 #endif
               // set DATA=0 ("I am here")
               writePinDATA(LOW);
@@ -4086,7 +4473,8 @@ void IECBusHandler::handleFastLoadProtocols()
                   writePinCLK(HIGH);
                   writePinDATA(HIGH);
 
-                  // no more sector operations
+                  // no more sector operations (epyxSectorOpsDone() gets called at the
+                  // end of task() via finishEpyxSectorOps)
                   m_currentDevice->m_flProtocol = IEC_FL_PROT_NONE;
                 }
             }
@@ -4210,12 +4598,27 @@ void IECBusHandler::task()
       // falling edge on RESET pin
       m_currentDevice = NULL;
       m_flags = 0;
+#if defined(IEC_FP_JIFFY) || defined(IEC_FP_DOLPHIN)
+      m_bufferLen = 0;
+#endif
       
       // release CLK and DATA, allow ATN to pull DATA low in hardware
       writePinCLK(HIGH);
       writePinDATA(HIGH);
       writePinCTRL(LOW);
 
+#ifdef IEC_SUPPORT_HOST_CALIBRATION
+      // host may come back up at a different speed => forget previous calibration
+      resetHostTiming();
+#endif
+
+#if defined(IEC_FP_EPYX) && defined(IEC_FP_EPYX_SECTOROPS)
+      // let devices write out any sectors they have held back before resetting them
+      m_inTask = false;
+      finishEpyxSectorOps(true);
+      m_inTask = true;
+#endif
+
       // call "reset" function for attached devices
       for(uint8_t i=0; i<m_numDevices; i++)
         m_devices[i]->reset(); 
@@ -4229,6 +4632,16 @@ void IECBusHandler::task()
       atnRequest();
     } 
 
+#if defined(IEC_FP_JIFFY) || defined(IEC_FP_DOLPHIN)
+  // pass on data still buffered by receiveBufferedByte before handling the ATN
+  // sequence (which may end the transaction). We are holding DATA low while 
+  // under ATN so the host will wait until we are done. The host has already
+  // received our acknowledgement for this data so if the device can not write
+  // it then all we can do is let the device know (see IECDevice.h)
+  if( (m_flags & P_ATN)!=0 && m_bufferLen>0 && m_currentDevice!=NULL && !flushReceiveBuffer(false) )
+    m_currentDevice->m_bufferedWriteError = true;
+#endif
+
 #ifdef ESP_PLATFORM
   // see comment in atnRequest function
   if( (m_flags & P_ATN)!=0 && !readPinATN() &&
@@ -4468,6 +4881,11 @@ void IECBusHandler::task()
   // make sure to process it before we leave
   if( m_atnInterrupt!=NOT_AN_INTERRUPT && !readPinATN() && !(m_flags & P_ATN) ) { noInterrupts(); atnRequest(); interrupts(); }
 
+#if defined(IEC_FP_EPYX) && defined(IEC_FP_EPYX_SECTOROPS)
+  // if a sequence of Epyx sector operations has ended then let the device know
+  finishEpyxSectorOps(false);
+#endif
+
   // call "task" function for attached devices
   for(uint8_t i=0; i<m_numDevices; i++)
     m_devices[i]->task(); 
@@ -82,6 +82,7 @@ class IECBusHandler
   static bool isFastLoaderSupported(uint8_t loader);
   bool enableFastLoader(IECDevice *dev, uint8_t protocol, bool enable);
   void fastLoadRequest(IECDevice *dev, uint8_t loader, uint8_t request);
+  uint8_t getActiveFastLoader(IECDevice *dev);
 
 #ifdef IEC_FP_DOLPHIN
   void enableDolphinBurstMode(IECDevice *dev, bool enable);
@@ -97,6 +98,14 @@ class IECBusHandler
 #endif
 #endif
 
+#ifdef IEC_SUPPORT_HOST_CALIBRATION
+  // host speed is given in 1/16 of the speed of a stock C64 (i.e. 16=stock, 32=twice as fast)
+  // setHostSpeed(0) enables automatic calibration (default), any other value fixes
+  // the fast-load timing at the given speed
+  void setHostSpeed(uint8_t speed);
+  uint8_t getHostSpeed();
+#endif
+
   IECDevice *findDevice(uint8_t devnr, bool includeInactive = false);
   bool canServeATN();
   bool inTransaction();
@@ -137,6 +146,15 @@ class IECBusHandler
   volatile uint8_t m_flags;
   uint8_t m_primary, m_secondary;
 
+#ifdef IEC_SUPPORT_HOST_CALIBRATION
+  void setHostTiming(uint16_t speed);
+  void calibrateHostTiming(uint8_t pulse);
+  void resetHostTiming();
+  uint8_t measureCLKHighTime();
+  uint8_t m_hostSpeed, m_hostTimingFactor, m_hostSpeedCandidate, m_hostSpeedCount;
+  bool m_hostSpeedFixed;
+#endif
+
 #ifdef IOREG_TYPE
   volatile IOREG_TYPE *m_regCLKwrite, *m_regCLKmode, *m_regDATAwrite, *m_regDATAmode;
   volatile const IOREG_TYPE *m_regATNread, *m_regCLKread, *m_regDATAread, *m_regRESETread;
@@ -146,6 +164,10 @@ class IECBusHandler
 #endif
 #endif
 
+#if defined(IEC_FP_EPYX) || defined(IEC_FP_HYPRALOAD)
+  void transmitBitSchedule(uint8_t data, const struct BitScheduleStep *schedule, uint8_t numSteps);
+#endif
+
 #ifdef IEC_FP_JIFFY 
   bool receiveJiffyByte(bool canWriteOk);
   bool transmitJiffyByte(uint8_t numData);
@@ -167,6 +189,12 @@ class IECBusHandler
   bool receiveDolphinBurst();
 #endif
 
+#if defined(IEC_FP_JIFFY) || defined(IEC_FP_DOLPHIN)
+  bool receiveBufferedByte(uint8_t data, bool eoi);
+  bool flushReceiveBuffer(bool eoi);
+  uint8_t m_bufferLen;
+#endif
+
 #ifdef IEC_SUPPORT_PARALLEL
   void startParallelTransaction();
   void endParallelTransaction();
@@ -186,6 +214,7 @@ class IECBusHandler
   uint8_t m_pinParallelSCK, m_pinParallelCOPI, m_pinParallelCIPO, m_pinParallelCS, m_inTransaction;
   uint8_t XRA1405_ReadReg(uint8_t reg);
   void    XRA1405_WriteReg(uint8_t reg, uint8_t data);
+  uint8_t m_parallelBusMode; // current content of XRA1405 GCR1 register (0xFF=input, 0x00=output)
 
 #ifdef IOREG_TYPE
   volatile IOREG_TYPE *m_regParallelCS;
@@ -221,9 +250,11 @@ class IECBusHandler
   bool transmitEpyxByte(uint8_t data);
   bool receiveEpyxHeader();
   bool transmitEpyxBlock();
+  bool m_epyxTalking;
 #ifdef IEC_FP_EPYX_SECTOROPS
   bool startEpyxSectorCommand(uint8_t command);
   bool finishEpyxSectorCommand();
+  void finishEpyxSectorOps(bool reset);
 #endif
 #endif
 
@@ -59,6 +59,14 @@
 // bufferSize argument of 255 or less
 //#define IEC_FP_EPYX_SECTOROPS
 
+// un-comment this to support hosts running at accelerated clock speeds (e.g. SuperCPU,
+// Turbo Chameleon, Ultimate 64 turbo modes). The bus handler measures how long the host
+// holds CLK high for each bit of the bytes received under ATN (i.e. before every transfer)
+// and, if the host is found to run significantly faster than a stock C64, compresses the
+// bit timing of the JiffyDos, Final Cartridge 3 and Action Replay 6 transmit routines
+// accordingly. The measured speed is kept until the next bus reset.
+//#define IEC_SUPPORT_HOST_CALIBRATION
+
 // defines the maximum number of devices that the bus handler will be
 // able to support - set to 4 by default but can be increased to up to 30 devices
 #define IEC_MAX_DEVICES 4
@@ -75,14 +83,50 @@
 // For other channels, the device's write() function will be called once the
 // buffer is full. Every instance of IECFileDevice will allocate this buffer
 // so it should be kept small on platforms with little RAM (e.g. Arduino UNO)
+// (unless IECFILEDEVICE_SHARED_WRITE_BUFFER is enabled, see below). Max 255.
 #define IECFILEDEVICE_WRITE_BUFFER_SIZE  64
 
+// un-comment this to have all instances of IECFileDevice share one write buffer
+// instead of each allocating its own. Only one device can receive data at a time,
+// the buffer gets bound to a device when the computer starts sending data to it
+// (if another device still has unprocessed data in the buffer, that data is processed
+// first). Useful when implementing multiple devices: saves RAM or allows a bigger
+// IECFILEDEVICE_WRITE_BUFFER_SIZE. The status and read buffers are not shared since
+// they hold data that must survive until the computer addresses the device again.
+//#define IECFILEDEVICE_SHARED_WRITE_BUFFER
+
+// un-comment this to give IECFileDevice a read-ahead buffer of the given size. When the 
+// computer reads a file, the device's read() function is then asked for chunks of up to 
+// this many bytes instead of 1-2 bytes at a time, greatly reducing overhead for standard IEC
+// and JiffyDos transfers. Note that read() is then called up to this many bytes ahead of
+// the computer (instead of 2), the device must call clearReadBuffer() if the file position
+// changes other than by reading (see README.md). There is one read-ahead buffer per device 
+// which is used by the channel that is read from first while the buffer is empty (i.e. usually
+// the file that is being loaded), other channels keep using a 2-byte look-ahead. Max 255.
+// Requires this many bytes of RAM for each instance of IECFileDevice (not recommended on AVR).
+//#define IECFILEDEVICE_READAHEAD_BUFFER_SIZE 128
+
+// support relative (REL) files in IECFileDevice, i.e. handle the "P" (position)
+// command on channel 15, reading and writing data record-by-record and padding
+// records. Devices supporting REL files must implement the seek() function and call
+// setRecordLength() from within their open() function (see README.md).
+// Requires 5 bytes of RAM per channel for each instance of IECFileDevice.
+#if !defined(__AVR__)
+#define IECFILEDEVICE_SUPPORT_REL
+#endif
+
 // buffer size for IECFileDevice transmitting data on channel 15, if
 // IECFileDevice::setStatus() is called with data longer than this it will be clipped.
 // every instance of IECFileDevice will allocate this buffer so it should be
 // kept small on platforms with little RAM (e.g. Arduino UNO)
 #define IECFILEDEVICE_STATUS_BUFFER_SIZE 40
 
+// un-comment this to have IECFileDevice keep transfer statistics (bytes sent/received,
+// transfers per protocol, transfer rates, aborted transfers and time spent waiting
+// for the device) which can be queried from the computer via "XS" commands on channel 15
+// (see "Transfer statistics" section in README.md)
+//#define IECFILEDEVICE_STATISTICS
+
 // convenience macro, IEC_SUPPORT_PARALLEL is defined if any of the supported
 // fast-load protocols use a parallel cable
 #if defined(IEC_FP_DOLPHIN) || defined(IEC_FP_SPEEDDOS)
@@ -33,6 +33,10 @@ IECDevice::IECDevice(uint8_t devnr)
   m_flEnabled  = 0;
   m_flFlags    = 0;
   m_flProtocol = IEC_FL_PROT_NONE;
+#if defined(IEC_FP_JIFFY) || defined(IEC_FP_DOLPHIN)
+  m_bufferedWrite = false;
+  m_bufferedWriteError = false;
+#endif
 }
 
 void IECDevice::setDeviceNumber(uint8_t devnr)
@@ -84,6 +88,11 @@ bool IECDevice::fastLoadRequest(uint8_t loader, uint8_t request)
     return false;
 }
 
+uint8_t IECDevice::getActiveFastLoader()
+{
+  return m_handler ? m_handler->getActiveFastLoader(this) : 0xFF;
+}
+
 #ifdef IEC_FP_DOLPHIN 
 void IECDevice::enableDolphinBurstMode(bool enable)
 {
@@ -113,9 +122,9 @@ uint8_t IECDevice::read(uint8_t *buffer, uint8_t bufferSize)
 #endif
 
 
-#if defined(IEC_FP_DOLPHIN) || defined(IEC_FP_FC3) || defined(IEC_FP_AR6)
+#if defined(IEC_FP_JIFFY) || defined(IEC_FP_DOLPHIN) || defined(IEC_FP_FC3) || defined(IEC_FP_AR6)
 // default implementation of "buffer write" function which can/should be overridden
-// (for efficiency) by devices using the DolphinDos protocol
+// (for efficiency) by devices using the JiffyDos or DolphinDos protocol
 uint8_t IECDevice::write(uint8_t *buffer, uint8_t bufferSize, bool eoi)
 {
   uint8_t i;
@@ -49,6 +49,14 @@ class IECDevice
   // if isActive() is not overloaded then use this to activate/deactivate a device
   void setActive(bool b) { m_isActive = b; }
 
+#if defined(IEC_FP_JIFFY) || defined(IEC_FP_DOLPHIN)
+  // call this if your device overloads write(buffer, bufferSize, eoi) (see below) to have
+  // data received via JiffyDos or DolphinDos (non-burst) collected and passed on in blocks.
+  // Otherwise each received byte is passed on via canWrite() and write(data, eoi).
+  // The IECFileDevice class enables this.
+  void setBufferedWrite(bool enable) { m_bufferedWrite = enable; }
+#endif
+
  protected:
   // called when IECBusHandler::begin() is called
   virtual void begin() {}
@@ -113,15 +121,19 @@ class IECDevice
   virtual uint8_t peek() { return 0; }
 #endif
 
-#if defined(IEC_FP_DOLPHIN) || defined(IEC_FP_FC3) || defined(IEC_FP_AR6)
-  // called when the device is sending data using the DolphinDos burst transfer (SAVE protocol)
+#if defined(IEC_FP_JIFFY) || defined(IEC_FP_DOLPHIN) || defined(IEC_FP_FC3) || defined(IEC_FP_AR6)
+  // called when the device is receiving data using the JiffyDos, DolphinDos (burst and regular),
+  // Final Cartridge 3 or Action Replay 6 SAVE protocols
   // should write all the data in the buffer and return the number of bytes written
   // returning less than bufferSize signals an error condition
   // the "eoi" parameter will be "true" if sender signaled that this is the final part of the transmission
   // write() is allowed to take an indefinite amount of time
   // the default implementation within IECDevice uses the canWrite() and write(data,eoi) functions,
   // which is not efficient.
-  // it is highly recommended to override this function in devices supporting DolphinDos
+  // it is highly recommended to override this function in devices supporting JiffyDos or DolphinDos
+  // If buffered writes are enabled (see setBufferedWrite()) then data still buffered when the
+  // computer asserts ATN has already been acknowledged. If write() can not process all of
+  // it then m_bufferedWriteError is set and the device should report the error (e.g. in its status)
   virtual uint8_t write(uint8_t *buffer, uint8_t bufferSize, bool eoi);
 #endif
 
@@ -142,6 +154,16 @@ class IECDevice
   // sector read/write operations (disk editor, disk copy or file copy).
   virtual bool epyxReadSector(uint8_t track, uint8_t sector, uint8_t *buffer)  { return false; }
   virtual bool epyxWriteSector(uint8_t track, uint8_t sector, uint8_t *buffer) { return false; }
+
+  // called when the computer has finished a sequence of sector operations, i.e. the
+  // host stopped sending further sector commands, the transfer was aborted by ATN
+  // or the bus was reset (called from task context, before the device's reset()).
+  // Devices may read ahead (e.g. a whole track) in epyxReadSector() and/or
+  // collect sectors passed to epyxWriteSector() in order to write them in larger 
+  // batches. Any such collected sectors must be written here at the latest.
+  // Note that epyxReadSector() must return the collected (not yet written) data
+  // if the computer reads a sector that it has previously written.
+  virtual void epyxSectorOpsDone() {}
 #endif
 
 #ifdef IEC_FP_DOLPHIN 
@@ -153,6 +175,10 @@ class IECDevice
 
   bool fastLoadRequest(uint8_t loader, uint8_t request);
 
+  // returns the fast-load protocol (IEC_FP_*) currently used for transfers 
+  // with this device or 0xFF if the standard IEC protocol is used
+  uint8_t getActiveFastLoader();
+
   // send pulse on SRQ line (if SRQ pin was set in IECBusHandler constructor)
   void sendSRQ();
 
@@ -162,6 +188,10 @@ class IECDevice
   uint8_t    m_flEnabled;  // bit-mask for which fast-loaders are enabled (IEC_FP_* in IECConfig.h)
   uint32_t   m_flFlags;    // internal fast-loader flags
   uint8_t    m_flProtocol; // currently active fast-load protocol
+#if defined(IEC_FP_JIFFY) || defined(IEC_FP_DOLPHIN)
+  bool       m_bufferedWrite;      // see setBufferedWrite()
+  bool       m_bufferedWriteError; // buffered data that was already acknowledged could not be written
+#endif
   IECBusHandler *m_handler;
 };
 
@@ -28,9 +28,24 @@
 // DEBUG==0 => debug data logging disabled
 // DEBUG==1 => debug data logging enabled, default on, can be disabled by calling IECFileDevice::setLogging()
 // DEBUG==2 => debug data logging enabled, default off, can be enabled by calling IECFileDevice::setLogging()
-// DEBUG >2 => additional debug logging that may break some timing (be careful!), default on
+// DEBUG >2 => additional debug logging of bus events, default on
+// Data and events logged from within read()/write()/canRead()/canWrite() (which must return
+// quickly) are stored as compact records in a ring buffer and only formatted and printed
+// when the bus is idle (from task() or before printing other debug output) or right before
+// and after data is passed to/from the device (where the bus is waiting for us anyway).
+// If the ring buffer overflows in between, events are dropped (and the number of dropped
+// records is printed) instead of delaying the bus transaction.
 #define DEBUG 0
 
+// number of records in the debug log ring buffer (must be a power of 2, max 256),
+// each record takes 2 bytes of RAM
+#ifndef DEBUG_LOG_SIZE
+#define DEBUG_LOG_SIZE 128
+#endif
+#if (DEBUG_LOG_SIZE & (DEBUG_LOG_SIZE-1))!=0 || DEBUG_LOG_SIZE>256
+#error "DEBUG_LOG_SIZE must be a power of 2 and at most 256"
+#endif
+
 #if DEBUG>0
 
 static void print_hex(uint8_t data)
@@ -44,7 +59,27 @@ static void print_hex(uint8_t data)
 static uint8_t dbgbuf[16], dbgnum = 0;
 bool dbglogdata = (DEBUG==1) || (DEBUG>2);
 
-static void dbg_print_data()
+// debug log ring buffer, a record consists of a tag and a value, 
+// tag 0 is a data byte (printed as hex dump), any other tag is an event
+// (printed as the tag character followed by the value in hex)
+static uint8_t dbglog[DEBUG_LOG_SIZE][2];
+static uint8_t dbglogHead = 0, dbglogTail = 0;
+static uint16_t dbglogDropped = 0;
+
+static void dbg_log(uint8_t tag, uint8_t value)
+{
+  uint8_t next = (dbglogHead+1) & (DEBUG_LOG_SIZE-1);
+  if( next==dbglogTail )
+    dbglogDropped++;
+  else
+    {
+      dbglog[dbglogHead][0] = tag;
+      dbglog[dbglogHead][1] = value;
+      dbglogHead = next;
+    }
+}
+
+static void dbg_print_line()
 {
   if( dbgnum>0 )
     {
@@ -67,12 +102,48 @@ static void dbg_print_data()
     }
 }
 
+static void dbg_drain_log(uint8_t maxRecords)
+{
+  // format and print up to maxRecords records from the debug log
+  while( dbglogTail!=dbglogHead && maxRecords-->0 )
+    {
+      uint8_t tag = dbglog[dbglogTail][0], value = dbglog[dbglogTail][1];
+      dbglogTail = (dbglogTail+1) & (DEBUG_LOG_SIZE-1);
+
+      if( tag==0 )
+        {
+          dbgbuf[dbgnum++] = value;
+          if( dbgnum==16 ) dbg_print_line();
+        }
+      else
+        {
+          Serial.write(tag); 
+          print_hex(value);
+        }
+    }
+
+  if( dbglogDropped>0 && dbglogTail==dbglogHead )
+    {
+      dbg_print_line();
+      Serial.print(F("[DEBUG LOG OVERFLOW, ")); Serial.print(dbglogDropped); Serial.println(F(" RECORDS DROPPED]"));
+      dbglogDropped = 0;
+    }
+}
+
+static void dbg_print_data()
+{
+  dbg_drain_log(DEBUG_LOG_SIZE-1);
+  dbg_print_line();
+}
+
 static void dbg_data(uint8_t data)
 {
+  // data is only logged right after it was passed to/from the device, if the
+  // log is full then make room by printing older records first
   if( dbglogdata )
     {
-      dbgbuf[dbgnum++] = data;
-      if( dbgnum==16 ) dbg_print_data();
+      if( ((dbglogHead+1) & (DEBUG_LOG_SIZE-1))==dbglogTail ) dbg_drain_log(DEBUG_LOG_SIZE/2);
+      dbg_log(0, data);
     }
 }
 
@@ -106,14 +177,45 @@ static void logStatus(uint8_t devnr, const char *data, uint8_t dataLen)
 #define IFD_EXEC  3
 #define IFD_WRITE 4
 
+// states for receiving channel 15 commands that do not fit into the write buffer
+#define EXS_NONE     0 // command fits into buffer (so far)
+#define EXS_STREAM   1 // command is passed on to device in chunks
+#define EXS_TRUNCATE 2 // device does not support streaming, command is cut off
+
 
 struct MWSignature { uint16_t address; uint8_t len; uint8_t checksum; };
 
+#ifdef IECFILEDEVICE_STATISTICS
+// index in m_statTransfers[] for transfers using the standard IEC protocol
+#define STAT_IEC 7
+// accumulate time spent in "stmt" (waiting for the device) as stall time
+#define STAT_STALL(stmt) { uint32_t t = micros(); stmt; statStall(micros()-t); }
+#else
+#define STAT_STALL(stmt) stmt
+#endif
+
+#ifdef IECFILEDEVICE_SHARED_WRITE_BUFFER
+uint8_t IECFileDevice::s_writeBuffer[IECFILEDEVICE_WRITE_BUFFER_SIZE];
+IECFileDevice *IECFileDevice::s_writeBufferOwner = NULL;
+#endif
+
+
 IECFileDevice::IECFileDevice(uint8_t devnr) : 
   IECDevice(devnr)
 {
+#ifdef IECFILEDEVICE_SHARED_WRITE_BUFFER
+  m_writeBuffer = s_writeBuffer;
+#endif
   m_cmd = IFD_NONE;
   m_opening = false;
+  m_execStream = EXS_NONE;
+#ifdef IECFILEDEVICE_STATISTICS
+  statClear();
+#endif
+#if defined(IEC_FP_JIFFY) || defined(IEC_FP_DOLPHIN)
+  // write(buffer, bufferSize, eoi) is implemented efficiently below
+  setBufferedWrite(true);
+#endif
 }
 
 
@@ -182,9 +284,17 @@ void IECFileDevice::begin()
   m_statusBufferLen = 0;
   m_writeBufferLen = 0;
   memset(m_readBufferLen, 0, 15);
+#ifdef IECFILEDEVICE_SUPPORT_REL
+  memset(m_relRecordLen, 0, 15);
+#endif
+#if IECFILEDEVICE_READAHEAD_BUFFER_SIZE>2
+  m_readAheadChannel = 0xFF;
+  m_readAheadPtr = m_readAheadLen = 0;
+#endif
   m_cmd = IFD_NONE;
   m_channel = 0xFF;
   m_opening = false;
+  m_execStream = EXS_NONE;
   m_eoi = true;
   m_statusEoi = true;
   m_uploadCtr = 0;
@@ -250,7 +360,7 @@ void IECFileDevice::executeData(const uint8_t *data, uint8_t len)
 int8_t IECFileDevice::canRead() 
 { 
 #if DEBUG>3
-  Serial.write('c');Serial.write('R');
+  dbg_log('c', 'R');
 #endif
 
   // see comment in IECFileDevice constructor
@@ -260,9 +370,9 @@ int8_t IECFileDevice::canRead()
       // here because we have already received the LISTEN after the UNLISTEN that
       // initiated the OPEN and so m_channel will not be set again => remember and restore it here
       if( m_cmd==IFD_OPEN )
-        { uint8_t c = m_channel; fileTask(); m_channel = c; }
+        { uint8_t c = m_channel; STAT_STALL(fileTask()); m_channel = c; }
       else
-        fileTask();
+        STAT_STALL(fileTask());
     }
 
   if( m_channel==15 )
@@ -289,7 +399,7 @@ int8_t IECFileDevice::canRead()
         }
       
 #if DEBUG>3
-      print_hex(min(m_statusBufferLen-m_statusBufferPtr, 2));
+      dbg_log('=', min(m_statusBufferLen-m_statusBufferPtr, 2));
 #endif
       return min(m_statusBufferLen-m_statusBufferPtr, 2);
     }
@@ -301,13 +411,16 @@ int8_t IECFileDevice::canRead()
     {
       // we have already signaled EOI => reset EOI flag so fillReadBuffer will
       // call read() again to see if there is more data
-      if( m_eoi && m_readBufferLen[m_channel]==0 ) m_eoi = false;
+      if( m_eoi && getReadBufferLen()==0 ) m_eoi = false;
 
-      fillReadBuffer();
+      STAT_STALL(fillReadBuffer());
+
+      // we only ever need to report 0 (no data), 1 (last byte) or 2 (more data)
+      uint8_t n = min(getReadBufferLen(), (uint8_t) 2);
 #if DEBUG>3
-      print_hex(m_readBufferLen[m_channel]);
+      dbg_log('=', n);
 #endif
-      return m_readBufferLen[m_channel];
+      return n;
     }
 }
 
@@ -318,11 +431,15 @@ uint8_t IECFileDevice::peek()
 
   if( m_channel==15 )
     data = m_statusBuffer[m_statusBufferPtr];
+#if IECFILEDEVICE_READAHEAD_BUFFER_SIZE>2
+  else if( m_channel<15 && m_channel==m_readAheadChannel )
+    data = m_readAhead[m_readAheadPtr];
+#endif
   else if( m_channel < 15 )
     data = m_readBuffer[m_channel][0];
 
 #if DEBUG>2
-  Serial.write('P'); print_hex(data);
+  dbg_log('P', data);
 #endif
 
   return data;
@@ -337,18 +454,32 @@ uint8_t IECFileDevice::read()
     data = m_statusBuffer[m_statusBufferPtr++];
   else if( m_channel<15 )
     {
-      data = m_readBuffer[m_channel][0];
-      if( m_readBufferLen[m_channel]==2 )
+#if IECFILEDEVICE_READAHEAD_BUFFER_SIZE>2
+      if( m_channel==m_readAheadChannel )
         {
-          m_readBuffer[m_channel][0] = m_readBuffer[m_channel][1];
-          m_readBufferLen[m_channel] = 1;
+          data = m_readAhead[m_readAheadPtr++];
+          m_readAheadLen--;
         }
       else
-        m_readBufferLen[m_channel] = 0;
+#endif
+      {
+        data = m_readBuffer[m_channel][0];
+        if( m_readBufferLen[m_channel]==2 )
+          {
+            m_readBuffer[m_channel][0] = m_readBuffer[m_channel][1];
+            m_readBufferLen[m_channel] = 1;
+          }
+        else
+          m_readBufferLen[m_channel] = 0;
+      }
+
+#ifdef IECFILEDEVICE_STATISTICS
+      statData(1, false);
+#endif
     }
 
 #if DEBUG>2
-  Serial.write('R'); print_hex(data);
+  dbg_log('R', data);
 #endif
 
   return data;
@@ -359,6 +490,17 @@ uint8_t IECFileDevice::read(uint8_t *buffer, uint8_t bufferSize)
 {
   uint8_t res = 0;
 
+#if IECFILEDEVICE_READAHEAD_BUFFER_SIZE>2
+  // get data from the read-ahead buffer (if any)
+  if( m_channel==m_readAheadChannel && m_readAheadLen>0 )
+    {
+      res = min(m_readAheadLen, bufferSize);
+      memcpy(buffer, m_readAhead+m_readAheadPtr, res);
+      m_readAheadPtr += res;
+      m_readAheadLen -= res;
+    }
+#endif
+
   // get data from our own 2-byte buffer (if any)
   // properly deal with the case where bufferSize==1
   while( m_readBufferLen[m_channel]>0 && res<bufferSize )
@@ -371,7 +513,7 @@ uint8_t IECFileDevice::read(uint8_t *buffer, uint8_t bufferSize)
   // get data from higher class
   while( res<bufferSize && !m_eoi )
     {
-      uint8_t n = read(m_channel, buffer+res, bufferSize-res, &m_eoi);
+      uint8_t n = readChannel(buffer+res, bufferSize-res, &m_eoi);
       if( n==0 ) m_eoi = true;
 #if DEBUG>0
       for(uint8_t i=0; i<n; i++) dbg_data(buffer[res+i]);
@@ -379,6 +521,10 @@ uint8_t IECFileDevice::read(uint8_t *buffer, uint8_t bufferSize)
       res += n;
     }
 
+#ifdef IECFILEDEVICE_STATISTICS
+  if( m_channel<15 ) statData(res, false);
+#endif
+
   return res;
 }
 
@@ -386,7 +532,12 @@ uint8_t IECFileDevice::read(uint8_t *buffer, uint8_t bufferSize)
 int8_t IECFileDevice::canWrite() 
 {
 #if DEBUG>3
-  Serial.write('c');Serial.write('W');
+  dbg_log('c', 'W');
+#endif
+
+#ifdef IECFILEDEVICE_SHARED_WRITE_BUFFER
+  // make sure the shared write buffer is ours before any data is written to it
+  bindWriteBuffer();
 #endif
 
   // see comment in IECFileDevice constructor
@@ -396,14 +547,30 @@ int8_t IECFileDevice::canWrite()
       // here because we have already received the TALK after the UNLISTEN that
       // initiated the OPEN and so m_channel will not be set again => remember and restore it here
       if( m_cmd==IFD_OPEN )
-        { uint8_t c = m_channel; fileTask(); m_channel = c; }
+        { uint8_t c = m_channel; STAT_STALL(fileTask()); m_channel = c; }
       else
-        fileTask();
+        STAT_STALL(fileTask());
     }
 
-  if( m_channel == 15 || m_opening )
+  if( m_channel == 15 )
+    {
+      if( m_writeBufferLen==IECFILEDEVICE_WRITE_BUFFER_SIZE-1 && m_execStream!=EXS_TRUNCATE )
+        {
+          // command does not fit into the write buffer => pass it on in chunks if the device
+          // supports it, otherwise the rest of the command will be discarded in write()
+          if( m_execStream==EXS_STREAM )
+            executeStreamData(m_writeBuffer, m_writeBufferLen);
+          else
+            m_execStream = executeStreamBegin(m_writeBuffer, m_writeBufferLen) ? EXS_STREAM : EXS_TRUNCATE;
+
+          if( m_execStream==EXS_STREAM ) m_writeBufferLen = 0;
+        }
+
+      return 1; // command channel
+    }
+  else if( m_opening )
     {
-      return 1; // command channel or opening file
+      return 1; // opening file
     }
   else if( m_channel > 15 || m_readBufferLen[m_channel]==-128 )
     {
@@ -413,7 +580,7 @@ int8_t IECFileDevice::canWrite()
     {
       // if write buffer is full then send it on now
       if( m_writeBufferLen==IECFILEDEVICE_WRITE_BUFFER_SIZE-1 )
-        emptyWriteBuffer();
+        STAT_STALL(emptyWriteBuffer());
       
       return (m_writeBufferLen<IECFILEDEVICE_WRITE_BUFFER_SIZE-1) ? 1 : 0;
     }
@@ -429,9 +596,13 @@ void IECFileDevice::write(uint8_t data, bool eoi)
   m_eoi |= eoi;
   if( m_writeBufferLen<IECFILEDEVICE_WRITE_BUFFER_SIZE-1 )
     m_writeBuffer[m_writeBufferLen++] = data;
+
+#ifdef IECFILEDEVICE_STATISTICS
+  if( m_channel<15 && !m_opening ) statData(1, true);
+#endif
  
 #if DEBUG>2
-  Serial.write('W'); print_hex(data);
+  dbg_log('W', data);
 #endif
 }
 
@@ -447,9 +618,12 @@ uint8_t IECFileDevice::write(uint8_t *buffer, uint8_t bufferSize, bool eoi)
 
       // now pass on new data
       m_eoi |= eoi;
-      uint8_t nn = write(m_channel, buffer, bufferSize, m_eoi);
+      uint8_t nn = writeChannel(buffer, bufferSize, m_eoi);
 #if DEBUG>0
       for(uint8_t i=0; i<nn; i++) dbg_data(buffer[i]);
+#endif
+#ifdef IECFILEDEVICE_STATISTICS
+      statData(nn, true);
 #endif
       return nn;
     }
@@ -461,7 +635,7 @@ uint8_t IECFileDevice::write(uint8_t *buffer, uint8_t bufferSize, bool eoi)
 void IECFileDevice::talk(uint8_t secondary)   
 {
 #if DEBUG>2
-  Serial.write('T'); print_hex(secondary);
+  dbg_log('T', secondary);
 #endif
 
   m_channel = secondary & 0x0F;
@@ -477,7 +651,7 @@ void IECFileDevice::talk(uint8_t secondary)
 void IECFileDevice::untalk() 
 {
 #if DEBUG>2
-  Serial.write('t');
+  dbg_log('t', m_channel);
 #endif
 
   // no current channel
@@ -488,7 +662,7 @@ void IECFileDevice::untalk()
 void IECFileDevice::listen(uint8_t secondary) 
 {
 #if DEBUG>2
-  Serial.write('L'); print_hex(secondary);
+  dbg_log('L', secondary);
 #endif
   m_channel = secondary & 0x0F;
   m_eoi = false;
@@ -510,12 +684,12 @@ void IECFileDevice::listen(uint8_t secondary)
 void IECFileDevice::unlisten() 
 {
 #if DEBUG>2
-  Serial.write('l'); Serial.write('0'+m_channel);
+  dbg_log('l', m_channel);
 #endif
 
   if( m_channel==15 )
     {
-      if( m_writeBufferLen>0 ) m_cmd = IFD_EXEC;
+      if( m_writeBufferLen>0 || m_execStream==EXS_STREAM ) m_cmd = IFD_EXEC;
       m_channel = 0xFF;
     }
   else if( m_opening )
@@ -561,15 +735,89 @@ bool IECFileDevice::epyxWriteSector(uint8_t track, uint8_t sector, uint8_t *buff
   return false;
 #endif
 }
+
+
+void IECFileDevice::epyxSectorOpsDone()
+{
+#if DEBUG>0
+  dbg_print_data();
+  Serial.println("Sector operations done"); Serial.flush();
+#endif
+}
 #endif
 
 
+uint8_t IECFileDevice::readChannel(uint8_t *buffer, uint8_t bufferSize, bool *eoi)
+{
+  // read data from the file open on the current channel
+#if DEBUG>0
+  // the device may take a while anyway => print logged records now
+  dbg_drain_log(DEBUG_LOG_SIZE-1);
+#endif
+#ifdef IECFILEDEVICE_SUPPORT_REL
+  if( m_relRecordLen[m_channel]>0 ) return relRead(m_channel, buffer, bufferSize, eoi);
+#endif
+  return read(m_channel, buffer, bufferSize, eoi);
+}
+
+
+uint8_t IECFileDevice::writeChannel(uint8_t *buffer, uint8_t bufferSize, bool eoi)
+{
+  // write data to the file open on the current channel
+#if DEBUG>0
+  // the device may take a while anyway => print logged records now
+  dbg_drain_log(DEBUG_LOG_SIZE-1);
+#endif
+#ifdef IECFILEDEVICE_SUPPORT_REL
+  if( m_relRecordLen[m_channel]>0 ) return relWrite(m_channel, buffer, bufferSize, eoi);
+#endif
+  return write(m_channel, buffer, bufferSize, eoi);
+}
+
+
+uint8_t IECFileDevice::getReadBufferLen()
+{
+  // returns the number of bytes buffered for the current channel
+#if IECFILEDEVICE_READAHEAD_BUFFER_SIZE>2
+  if( m_channel==m_readAheadChannel ) return m_readAheadLen;
+#endif
+  return m_readBufferLen[m_channel];
+}
+
+
 void IECFileDevice::fillReadBuffer()
 {
+#if IECFILEDEVICE_READAHEAD_BUFFER_SIZE>2
+  // use the read-ahead buffer if this channel already owns it or if it is
+  // empty and this channel has no data in its 2-byte buffer
+  if( m_channel==m_readAheadChannel || (m_readAheadLen==0 && m_readBufferLen[m_channel]==0) )
+    {
+      m_readAheadChannel = m_channel;
+      if( m_readAheadLen<2 && !m_eoi )
+        {
+          // move the remaining byte (if any) to the start and fill up the rest
+          if( m_readAheadLen>0 ) m_readAhead[0] = m_readAhead[m_readAheadPtr];
+          m_readAheadPtr = 0;
+
+          while( m_readAheadLen<2 && !m_eoi )
+            {
+              uint8_t n = readChannel(m_readAhead+m_readAheadLen, IECFILEDEVICE_READAHEAD_BUFFER_SIZE-m_readAheadLen, &m_eoi);
+              if( n==0 ) m_eoi = true;
+#if DEBUG==1
+              for(uint8_t i=0; i<n; i++) dbg_data(m_readAhead[m_readAheadLen+i]);
+#endif
+              m_readAheadLen += n;
+            }
+        }
+
+      return;
+    }
+#endif
+
   while( m_readBufferLen[m_channel]<2 && !m_eoi )
     {
       uint8_t n = 2-m_readBufferLen[m_channel];
-      n = read(m_channel, m_readBuffer[m_channel]+m_readBufferLen[m_channel], n, &m_eoi);
+      n = readChannel(m_readBuffer[m_channel]+m_readBufferLen[m_channel], n, &m_eoi);
       if( n==0 ) m_eoi = true;
 #if DEBUG==1
       for(uint8_t i=0; i<n; i++) dbg_data(m_readBuffer[m_channel][m_readBufferLen[m_channel]+i]);
@@ -583,7 +831,7 @@ void IECFileDevice::emptyWriteBuffer()
 {
   if( m_writeBufferLen>0 )
     {
-      uint8_t n = write(m_channel, m_writeBuffer, m_writeBufferLen, m_eoi);
+      uint8_t n = writeChannel(m_writeBuffer, m_writeBufferLen, m_eoi);
 #if DEBUG==1
       for(uint8_t i=0; i<n; i++) dbg_data(m_writeBuffer[i]);
 #endif
@@ -598,9 +846,36 @@ void IECFileDevice::emptyWriteBuffer()
 }
 
 
+#ifdef IECFILEDEVICE_SHARED_WRITE_BUFFER
+void IECFileDevice::bindWriteBuffer()
+{
+  if( s_writeBufferOwner!=this )
+    {
+      // if the previous owner still has a command (OPEN, EXECUTE or WRITE) pending
+      // then its data is still in the buffer => process it now. It will usually already
+      // have been processed in the previous owner's task() function but devices that
+      // can not serve ATN only process commands when they are addressed again.
+      if( s_writeBufferOwner!=NULL && s_writeBufferOwner->m_cmd!=IFD_NONE )
+        s_writeBufferOwner->fileTask();
+
+      s_writeBufferOwner = this;
+    }
+}
+#endif
+
+
 void IECFileDevice::clearReadBuffer(uint8_t channel)
 {
-  if( channel<16 ) m_readBufferLen[channel] = 0;
+  if( channel<15 ) m_readBufferLen[channel] = 0;
+
+#if IECFILEDEVICE_READAHEAD_BUFFER_SIZE>2
+  // release the read-ahead buffer if this channel owns it
+  if( channel==m_readAheadChannel )
+    {
+      m_readAheadChannel = 0xFF;
+      m_readAheadPtr = m_readAheadLen = 0;
+    }
+#endif
 }
 
 
@@ -634,6 +909,18 @@ void IECFileDevice::fileTask()
     }
 #endif
 
+#if defined(IEC_FP_JIFFY) || defined(IEC_FP_DOLPHIN)
+  if( m_bufferedWriteError )
+    {
+      // received data that was already acknowledged to the computer could not
+      // be written (see IECDevice.h) => report it through the status channel
+      char buf[21];
+      strcpy_P(buf, PSTR("25,WRITE ERROR,00,00"));
+      setStatus(buf, strlen(buf));
+      m_bufferedWriteError = false;
+    }
+#endif
+
   switch( m_cmd )
     {
     case IFD_OPEN:
@@ -646,9 +933,17 @@ void IECFileDevice::fileTask()
         Serial.print(m_devnr); Serial.write('#');
 #endif
         Serial.print(m_channel); Serial.print(F(": ")); Serial.println((const char *) m_writeBuffer);
+#endif
+#ifdef IECFILEDEVICE_SUPPORT_REL
+        // open() will call setRecordLength() if this is a relative file
+        m_relRecordLen[m_channel] = 0;
 #endif
         bool ok = open(m_channel, (const char *) m_writeBuffer, m_writeBufferLen);
-        m_readBufferLen[m_channel] = ok ? 0 : -128;
+        clearReadBuffer(m_channel);
+        if( !ok ) m_readBufferLen[m_channel] = -128;
+#ifdef IECFILEDEVICE_STATISTICS
+        if( ok ) statOpen(m_channel);
+#endif
         m_writeBufferLen = 0;
         m_channel = 0xFF; 
         break;
@@ -668,8 +963,14 @@ void IECFileDevice::fileTask()
         emptyWriteBuffer();
         m_writeBufferLen = 0;
 
+#ifdef IECFILEDEVICE_STATISTICS
+        statClose(m_channel);
+#endif
         close(m_channel); 
-        m_readBufferLen[m_channel] = 0;
+        clearReadBuffer(m_channel);
+#ifdef IECFILEDEVICE_SUPPORT_REL
+        if( m_channel<15 ) m_relRecordLen[m_channel] = 0;
+#endif
         m_channel = 0xFF;
         break;
       }
@@ -703,12 +1004,26 @@ void IECFileDevice::fileTask()
           }
 #endif
 
-        // first check whether this command is part of a supported fast loader request,
-        // if NOT then let the execute() function handle it
-        if( !isFastLoaderRequest(cmd) )
+        // if the command is being streamed then pass on the final chunk, otherwise first
+        // check whether this command is part of a supported fast loader request
+        // (or a statistics request), if NOT then let the execute() function handle it
+        if( m_execStream==EXS_STREAM )
+          executeStreamEnd(m_writeBuffer, m_writeBufferLen);
+        else if( isFastLoaderRequest(cmd) )
+          { /* fast-loader request has been handled */ }
+#ifdef IECFILEDEVICE_STATISTICS
+        else if( isStatisticsRequest(cmd) )
+          { /* statistics request has been handled */ }
+#endif
+#ifdef IECFILEDEVICE_SUPPORT_REL
+        else if( isPositionRequest(m_writeBuffer, m_writeBufferLen) )
+          { /* position request for relative file has been handled */ }
+#endif
+        else
           executeData(m_writeBuffer, m_writeBufferLen);
 
         m_writeBufferLen = 0;
+        m_execStream = EXS_NONE;
         break;
       }
     }
@@ -1028,6 +1343,341 @@ bool IECFileDevice::checkMWcmd(uint16_t addr, uint8_t len, uint8_t checksum) con
 }
 
 
+#ifdef IECFILEDEVICE_SUPPORT_REL
+
+// m_relUsed[channel] value signaling that the file position for the current
+// record has not been set yet
+#define REL_UNKNOWN 0xFF
+
+
+void IECFileDevice::setRecordLength(uint8_t channel, uint8_t recordLength)
+{
+  if( channel<15 )
+    {
+      m_relRecordLen[channel] = min(recordLength, (uint8_t) 254);
+      m_relRecord[channel] = 0;
+      m_relPos[channel] = 0;
+      m_relUsed[channel] = REL_UNKNOWN;
+    }
+}
+
+
+bool IECFileDevice::isPositionRequest(const uint8_t *cmd, uint8_t len)
+{
+  // "P" command: P, channel (+96), record number (low, high, starting at 1), position in record (starting at 1)
+  if( len<3 || cmd[0]!='P' || (cmd[1] & 0x0F)>=15 || m_relRecordLen[cmd[1] & 0x0F]==0 )
+    return false;
+
+  uint8_t channel = cmd[1] & 0x0F;
+  uint16_t record = cmd[2] + (len>3 ? 256*cmd[3] : 0);
+  uint8_t  pos    = len>4 ? cmd[4] : 1;
+
+  m_relRecord[channel] = record>0 ? record-1 : 0;
+  m_relPos[channel]    = pos>0 ? min(pos, m_relRecordLen[channel])-1 : 0;
+  m_relUsed[channel]   = REL_UNKNOWN;
+  clearReadBuffer(channel);
+
+  if( relSeek(channel, false) )
+    clearStatus();
+  else
+    setStatus("50,RECORD NOT PRESENT,00,00", 27);
+
+  return true;
+}
+
+
+bool IECFileDevice::relSeek(uint8_t channel, bool extend)
+{
+  // set file position to the current position within the current record,
+  // returns false if the record does not exist (unless extend==true, in which
+  // case the file is extended with empty records up to the current record)
+  uint32_t start = (uint32_t) m_relRecord[channel] * m_relRecordLen[channel];
+  uint32_t pos   = seek(channel, start + m_relPos[channel]);
+  if( pos>=start+m_relPos[channel] ) 
+    return true;
+  else if( !extend )
+    return false;
+
+  // fill the file with zeros up to the end of the current record
+  static const uint8_t zero[16] = {0};
+  uint32_t end = start + m_relRecordLen[channel];
+  while( pos<end )
+    {
+      uint8_t n = write(channel, (uint8_t *) zero, min(end-pos, (uint32_t) 16), false);
+      if( n==0 ) return false;
+      pos += n;
+    }
+
+  return seek(channel, start + m_relPos[channel])==start + m_relPos[channel];
+}
+
+
+uint8_t IECFileDevice::relRead(uint8_t channel, uint8_t *buffer, uint8_t bufferSize, bool *eoi)
+{
+  uint8_t recordLen = m_relRecordLen[channel];
+
+  if( m_relUsed[channel]==REL_UNKNOWN )
+    {
+      // starting to read the current record => read the whole record to determine
+      // its used length (trailing zeros are not sent), then go back to our position
+      uint8_t record[254], n = 0, pos = m_relPos[channel];
+      m_relPos[channel] = 0;
+      if( relSeek(channel, false) )
+        {
+          bool e = false;
+          while( n<recordLen && !e )
+            {
+              uint8_t nn = read(channel, record+n, recordLen-n, &e);
+              if( nn==0 ) break;
+              n += nn;
+            }
+        }
+
+      if( n==0 )
+        {
+          // record does not exist => send CR and report error
+          setStatus("50,RECORD NOT PRESENT,00,00", 27);
+          buffer[0] = 13;
+          *eoi = true;
+          return 1;
+        }
+
+      while( n>0 && record[n-1]==0 ) n--;
+      m_relUsed[channel] = n;
+      m_relPos[channel]  = pos;
+      relSeek(channel, false);
+    }
+
+  uint8_t n = 0;
+  if( m_relUsed[channel]==0 )
+    {
+      // empty record => send a single $FF
+      buffer[0] = 0xFF;
+      n = 1;
+      m_relPos[channel] = recordLen;
+    }
+  else if( m_relPos[channel]<m_relUsed[channel] )
+    {
+      bool e = false;
+      n = read(channel, buffer, min(bufferSize, (uint8_t) (m_relUsed[channel]-m_relPos[channel])), &e);
+      m_relPos[channel] += n;
+    }
+
+  if( n==0 || m_relPos[channel]>=m_relUsed[channel] )
+    {
+      // end of record => signal EOI and advance to next record
+      m_relRecord[channel]++;
+      m_relPos[channel]  = 0;
+      m_relUsed[channel] = REL_UNKNOWN;
+      *eoi = true;
+    }
+
+  return n;
+}
+
+
+uint8_t IECFileDevice::relWrite(uint8_t channel, uint8_t *buffer, uint8_t bufferSize, bool eoi)
+{
+  uint8_t recordLen = m_relRecordLen[channel];
+
+  if( m_relUsed[channel]==REL_UNKNOWN )
+    {
+      // starting to write the current record => go to our position, creating the record if necessary
+      if( !relSeek(channel, true) ) return 0;
+      m_relUsed[channel] = recordLen;
+    }
+
+  // data beyond the end of the record is discarded
+  uint8_t n = min(bufferSize, (uint8_t) (recordLen-m_relPos[channel]));
+  if( n>0 )
+    {
+      uint8_t nn = write(channel, buffer, n, false);
+      m_relPos[channel] += nn;
+      if( nn<n ) return nn;
+    }
+
+  if( n<bufferSize )
+    setStatus("51,OVERFLOW IN RECORD,00,00", 27);
+
+  if( eoi )
+    {
+      // end of data => fill the rest of the record with zeros and advance to next record
+      static const uint8_t zero[16] = {0};
+      while( m_relPos[channel]<recordLen )
+        {
+          uint8_t nn = write(channel, (uint8_t *) zero, min(recordLen-m_relPos[channel], 16), false);
+          if( nn==0 ) break;
+          m_relPos[channel] += nn;
+        }
+
+      m_relRecord[channel]++;
+      m_relPos[channel]  = 0;
+      m_relUsed[channel] = REL_UNKNOWN;
+    }
+
+  return bufferSize;
+}
+
+#endif
+
+
+#ifdef IECFILEDEVICE_STATISTICS
+
+static uint32_t statRate(uint32_t bytes, uint32_t ms)
+{
+  // returns transfer rate in bytes/second
+  return ms==0 ? 0 : (bytes/ms)*1000 + ((bytes%ms)*1000)/ms;
+}
+
+
+void IECFileDevice::statClear()
+{
+  m_statBytesRead = 0;
+  m_statBytesWritten = 0;
+  m_statStallTime = 0;
+  m_statStallMicros = 0;
+  m_statTransferTime = 0;
+  m_statTransferTotal = 0;
+  m_statLastRate = 0;
+  m_statPeakRate = 0;
+  m_statAborted = 0;
+  memset(m_statTransfers, 0, sizeof(m_statTransfers));
+  m_statChannel = 0xFF;
+  m_statLastLoader = STAT_IEC;
+}
+
+
+void IECFileDevice::statOpen(uint8_t channel)
+{
+  // a transfer starts when a file is opened on a data channel
+  if( channel<15 )
+    {
+      m_statChannel = channel;
+      m_statTransferStart = millis();
+      m_statTransferBytes = 0;
+      m_statLoader = STAT_IEC;
+      m_statEnded = false;
+    }
+}
+
+
+void IECFileDevice::statData(uint8_t n, bool write)
+{
+  if( write ) 
+    m_statBytesWritten += n;
+  else
+    m_statBytesRead += n;
+
+  if( m_channel==m_statChannel )
+    {
+      m_statTransferBytes += n;
+
+      // remember fast-load protocol used for this transfer (for some loaders the
+      // first bytes are transmitted using the standard protocol)
+      uint8_t loader = getActiveFastLoader();
+      if( loader<STAT_IEC ) m_statLoader = loader;
+
+      // the transfer is complete once the device has signaled end-of-data (reading)
+      // or the computer has signaled EOI with the final byte (writing)
+      if( m_eoi ) m_statEnded = true;
+    }
+}
+
+
+void IECFileDevice::statStall(uint32_t us)
+{
+  // stall time is kept in milliseconds (a microsecond count would wrap after
+  // about 71 minutes), the remaining microseconds are carried over
+  us += m_statStallMicros;
+  m_statStallTime  += us/1000;
+  m_statStallMicros = us%1000;
+}
+
+
+void IECFileDevice::statClose(uint8_t channel)
+{
+  // a transfer ends when the file is closed
+  if( channel==m_statChannel )
+    {
+      if( m_statTransferBytes>0 )
+        {
+          uint32_t ms = millis()-m_statTransferStart;
+          m_statTransferTime += ms;
+          m_statTransferTotal += m_statTransferBytes;
+          m_statTransfers[m_statLoader]++;
+          if( !m_statEnded ) m_statAborted++;
+
+          m_statLastLoader = m_statLoader;
+          m_statLastRate = statRate(m_statTransferBytes, ms);
+          if( m_statLastRate>m_statPeakRate ) m_statPeakRate = m_statLastRate;
+        }
+
+      m_statChannel = 0xFF;
+    }
+}
+
+
+bool IECFileDevice::isStatisticsRequest(const char *cmd)
+{
+  // "XS"  : bytes read/written, aborted transfers and stall time (ms)
+  // "XSR" : protocol of last transfer, last/average/peak transfer rate (KB/s)
+  // "XSP" : number of transfers per protocol
+  // "XS0" : clear statistics
+  // ignore trailing CRs (PRINT# sends one after the command), as executeData() does
+  uint8_t len = m_writeBufferLen;
+  while( len>0 && cmd[len-1]==13 ) len--;
+  if( len<2 || cmd[0]!='X' || cmd[1]!='S' || len>3 )
+    return false;
+
+  // J=JiffyDos, E=Epyx, F=Final Cartridge 3, A=Action Replay 6, 
+  // D=DolphinDos, S=SpeedDos, H=Hypra-Load, I=standard IEC
+  static const char loaders[9] = "JEFADSHI";
+  char buf[IECFILEDEVICE_STATUS_BUFFER_SIZE+1];
+
+  // setStatus() clips the status to IECFILEDEVICE_STATUS_BUFFER_SIZE characters,
+  // leave room for the ",00,00" (track/sector) that is appended at the end
+  const uint8_t size = sizeof(buf)-6;
+  uint8_t n;
+
+  if( len==2 )
+    n = snprintf(buf, size, "00,R%lu W%lu A%u S%lu", 
+                 (unsigned long) m_statBytesRead, (unsigned long) m_statBytesWritten, 
+                 m_statAborted, (unsigned long) m_statStallTime);
+  else if( cmd[2]=='R' )
+    {
+      // average is taken over the same (completed) transfers as last/peak rate
+      uint32_t avg = statRate(m_statTransferTotal, m_statTransferTime);
+      n = snprintf(buf, size, "00,%c %lu.%lu %lu.%lu %lu.%lu", loaders[m_statLastLoader],
+                   (unsigned long) (m_statLastRate/1024), (unsigned long) ((m_statLastRate%1024)*10/1024),
+                   (unsigned long) (avg/1024),            (unsigned long) ((avg%1024)*10/1024),
+                   (unsigned long) (m_statPeakRate/1024), (unsigned long) ((m_statPeakRate%1024)*10/1024));
+    }
+  else if( cmd[2]=='P' )
+    {
+      n = snprintf(buf, size, "00,");
+      for(uint8_t i=0; i<8 && n<size; i++)
+        n += snprintf(buf+n, size-n, "%c%u ", loaders[i], m_statTransfers[i]);
+      if( n<size ) n--; // remove trailing space
+    }
+  else if( cmd[2]=='0' )
+    {
+      statClear();
+      n = snprintf(buf, size, "00, OK");
+    }
+  else
+    return false;
+
+  // snprintf returns the length the string would have had without clipping
+  if( n>size-1 ) n = size-1;
+  strcpy(buf+n, ",00,00");
+
+  setStatus(buf, strlen(buf));
+  return true;
+}
+
+#endif
+
+
 void IECFileDevice::setStatus(const char *data, uint8_t dataLen)
 {
 #if DEBUG>0
@@ -1059,9 +1709,17 @@ void IECFileDevice::reset()
   m_statusBufferLen = 0;
   m_writeBufferLen = 0;
   memset(m_readBufferLen, 0, 15);
+#ifdef IECFILEDEVICE_SUPPORT_REL
+  memset(m_relRecordLen, 0, 15);
+#endif
+#if IECFILEDEVICE_READAHEAD_BUFFER_SIZE>2
+  m_readAheadChannel = 0xFF;
+  m_readAheadPtr = m_readAheadLen = 0;
+#endif
   m_channel = 0xFF;
   m_cmd = IFD_NONE;
   m_opening = false;
+  m_execStream = EXS_NONE;
   m_uploadCtr = 0;
   m_eoi = true;
   m_statusEoi = true;
@@ -1074,4 +1732,10 @@ void IECFileDevice::task()
 {
   // see comment in IECFileDevice constructor
   if( m_canServeATN ) fileTask();
+
+#if DEBUG>0
+  // print some of the logged debug data while no bus transaction is in progress,
+  // limit the number of records per call so task() keeps returning quickly
+  if( m_channel==0xFF ) dbg_drain_log(16);
+#endif
 }
@@ -89,9 +89,27 @@ class IECFileDevice : public IECDevice
   // and do not contain biary data such as NUL or CR characters.
   virtual void execute(const char *command) {}
 
+  // called when the bus master sends a command to channel 15 that does not fit into
+  // the write buffer (IECFILEDEVICE_WRITE_BUFFER_SIZE-1 bytes). Return "true" to receive
+  // the command in chunks: executeStreamBegin() receives the first chunk, executeStreamData()
+  // any following chunks and executeStreamEnd() the final (possibly empty) chunk after the
+  // bus master has finished sending. Trailing CRs are NOT stripped off.
+  // If "false" is returned (default) then the command is cut off at the buffer size and
+  // passed to executeData() as usual.
+  virtual bool executeStreamBegin(const uint8_t *data, uint8_t len) { return false; }
+  virtual void executeStreamData(const uint8_t *data, uint8_t len) {}
+  virtual void executeStreamEnd(const uint8_t *data, uint8_t len) {}
+
   // called on falling edge of RESET line
   virtual void reset();
 
+#ifdef IECFILEDEVICE_SUPPORT_REL
+  // set the read/write position for the file open on channel to byte "pos",
+  // if the file is shorter than that then set the position to the end of the file.
+  // Returns the new position. Only called for relative files (see setRecordLength())
+  virtual uint32_t seek(uint8_t channel, uint32_t pos) { return 0; }
+#endif
+
   // can be called by derived class to set the status buffer
   void setStatus(const char *data, uint8_t dataLen);
 
@@ -99,6 +117,14 @@ class IECFileDevice : public IECDevice
   // to be called again the next time the status channel is queried
   void clearStatus();
 
+#ifdef IECFILEDEVICE_SUPPORT_REL
+  // can be called by derived class from within open() to declare the file opened on 
+  // channel a relative file with the given record length (1-254). IECFileDevice will
+  // then handle the "P" command for this channel and read/write data record-by-record,
+  // using seek() to position within the file.
+  void setRecordLength(uint8_t channel, uint8_t recordLength);
+#endif
+
   // clear the internal read buffer of the given channel, calling this will ensure
   // that the next TALK command will immediately call "read" to get new data instead 
   // of first sending the contents of the buffer
@@ -111,6 +137,7 @@ class IECFileDevice : public IECDevice
 #if defined(IEC_FP_EPYX) && defined(IEC_FP_EPYX_SECTOROPS)
   virtual bool epyxReadSector(uint8_t track, uint8_t sector, uint8_t *buffer);
   virtual bool epyxWriteSector(uint8_t track, uint8_t sector, uint8_t *buffer);
+  virtual void epyxSectorOpsDone();
 #endif
 
  private:
@@ -128,22 +155,61 @@ class IECFileDevice : public IECDevice
   virtual uint8_t peek();
 
   void fillReadBuffer();
+  uint8_t getReadBufferLen();
+  uint8_t readChannel(uint8_t *buffer, uint8_t bufferSize, bool *eoi);
+  uint8_t writeChannel(uint8_t *buffer, uint8_t bufferSize, bool eoi);
   void emptyWriteBuffer();
   void fileTask();
   bool isFastLoaderRequest(const char *cmd);
   bool checkMWcmd(uint16_t addr, uint8_t len, uint8_t checksum) const;
   bool checkMWcmds(const struct MWSignature *sig, uint8_t sigLen, uint8_t offset);
 
+#ifdef IECFILEDEVICE_SUPPORT_REL
+  bool isPositionRequest(const uint8_t *cmd, uint8_t len);
+  bool relSeek(uint8_t channel, bool extend);
+  uint8_t relRead(uint8_t channel, uint8_t *buffer, uint8_t bufferSize, bool *eoi);
+  uint8_t relWrite(uint8_t channel, uint8_t *buffer, uint8_t bufferSize, bool eoi);
+
+  uint16_t m_relRecord[15];
+  uint8_t  m_relRecordLen[15], m_relPos[15], m_relUsed[15];
+#endif
+
+#ifdef IECFILEDEVICE_STATISTICS
+  void statOpen(uint8_t channel);
+  void statClose(uint8_t channel);
+  void statData(uint8_t n, bool write);
+  void statStall(uint32_t us);
+  void statClear();
+  bool isStatisticsRequest(const char *cmd);
+
+  uint32_t m_statBytesRead, m_statBytesWritten, m_statStallTime, m_statTransferTime, m_statTransferTotal;
+  uint32_t m_statTransferStart, m_statTransferBytes, m_statLastRate, m_statPeakRate;
+  uint16_t m_statTransfers[8], m_statAborted, m_statStallMicros;
+  uint8_t  m_statChannel, m_statLoader, m_statLastLoader;
+  bool     m_statEnded;
+#endif
+
   bool    m_opening, m_eoi, m_statusEoi, m_canServeATN;
-  uint8_t m_channel, m_cmd, m_uploadCtr;
+  uint8_t m_channel, m_cmd, m_uploadCtr, m_execStream;
 #if defined(IEC_FP_AR6)
   uint8_t m_ar6detect;
 #endif
+#ifdef IECFILEDEVICE_SHARED_WRITE_BUFFER
+  void bindWriteBuffer();
+  static uint8_t s_writeBuffer[IECFILEDEVICE_WRITE_BUFFER_SIZE];
+  static IECFileDevice *s_writeBufferOwner;
+  uint8_t *m_writeBuffer;
+#else
   uint8_t m_writeBuffer[IECFILEDEVICE_WRITE_BUFFER_SIZE];
+#endif
 
   uint8_t m_readBuffer[15][2];
   uint8_t m_statusBufferLen, m_statusBufferPtr, m_writeBufferLen;
   int8_t  m_readBufferLen[15];
+#if IECFILEDEVICE_READAHEAD_BUFFER_SIZE>2
+  uint8_t m_readAhead[IECFILEDEVICE_READAHEAD_BUFFER_SIZE];
+  uint8_t m_readAheadChannel, m_readAheadPtr, m_readAheadLen;
+#endif
   char    m_statusBuffer[IECFILEDEVICE_STATUS_BUFFER_SIZE];
 };
 